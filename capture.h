@@ -0,0 +1,31 @@
+/*
+ * capture.h - The format of the allocator calls that shim.c captures
+ *     from a running program, for mdriver to replay
+ *
+ * A capture file is a capthdr_t followed by the records, in the order
+ * the per-thread buffers were written out rather than in the order of
+ * the calls; mdriver sorts them by their timestamps. Pointers and sizes
+ * are 64-bit, so that a 32-bit mdriver reads the captures of a 64-bit
+ * program.
+ */
+#include <stdint.h>
+
+#define CAPTURE_MAGIC "mmcapt01" /* the first bytes of a capture file */
+
+/* The types of call */
+enum {CAPTURE_MALLOC, CAPTURE_CALLOC, CAPTURE_MEMALIGN, CAPTURE_REALLOC, CAPTURE_FREE};
+
+typedef struct {
+    char magic[8];
+    uint32_t rec_bytes;  /* sizeof(caprec_t) */
+    uint32_t pid;        /* of the captured process */
+} capthdr_t;
+
+typedef struct {
+    uint64_t nsecs;      /* CLOCK_MONOTONIC before a free or realloc, else after */
+    uint64_t ptr;        /* block freed or reallocated, else 0 */
+    uint64_t result;     /* block returned, else 0 */
+    uint64_t size;       /* bytes asked for; nmemb * size for calloc */
+    uint32_t tid;        /* thread that made the call */
+    uint32_t type;       /* CAPTURE_MALLOC, ... */
+} caprec_t;
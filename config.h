@@ -58,7 +58,8 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes, reserved but not committed;
+ * mdriver -m sets another at run time
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
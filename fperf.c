@@ -0,0 +1,123 @@
+/*
+ * fperf.c - Count the hardware events of a function f
+ *
+ * Every event gets a counter of its own, limited to this thread in
+ * user mode, so that it works at the default perf_event_paranoid. If
+ * the machine has fewer counters than events, the kernel takes turns
+ * with them, and each count is scaled up by the share of the time its
+ * counter actually ran.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "fperf.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+const char *fperf_names[FPERF_EVENTS] = {
+    "instr", "LLCmiss", "TLBmiss", "brmiss", "faults"
+};
+
+static int fds[FPERF_EVENTS] = {-1, -1, -1, -1, -1};
+
+extern int verbose; /* -v option in mdriver.c */
+
+#ifdef __linux__
+/*
+ * open_counter - open a counter of an event, disabled, or return -1
+ */
+static int open_counter(unsigned type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/*
+ * init_fperf - open the counters, returning how many there are
+ */
+int init_fperf(void)
+{
+    int i, n = 0;
+
+#ifdef __linux__
+    if (fds[0] < 0) {
+	fds[FPERF_INSTRUCTIONS] =
+	    open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	fds[FPERF_CACHE_MISSES] =
+	    open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	fds[FPERF_DTLB_MISSES] =
+	    open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+			 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	fds[FPERF_BRANCH_MISSES] =
+	    open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	fds[FPERF_PAGE_FAULTS] =
+	    open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+    }
+#endif
+    for (i = 0; i < FPERF_EVENTS; i++) {
+	if (fds[i] >= 0)
+	    n++;
+	else if (verbose)
+	    printf("Can't count %s with perf_event_open.\n", fperf_names[i]);
+    }
+    return n;
+}
+
+/*
+ * fperf - count the events of f(argp), as the least of n runs
+ */
+void fperf(fperf_test_funct f, void *argp, int n, double counts[FPERF_EVENTS])
+{
+    int i;
+
+    for (i = 0; i < FPERF_EVENTS; i++)
+	counts[i] = -1;
+#ifdef __linux__
+    unsigned long long value[3];  /* count, time enabled, time running */
+    double count;
+    int run;
+
+    for (run = 0; run < n; run++) {
+	for (i = 0; i < FPERF_EVENTS; i++) {
+	    if (fds[i] >= 0) {
+		ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	    }
+	}
+	f(argp);
+	for (i = 0; i < FPERF_EVENTS; i++)
+	    if (fds[i] >= 0)
+		ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+	for (i = 0; i < FPERF_EVENTS; i++) {
+	    if (fds[i] < 0 ||
+		read(fds[i], value, sizeof(value)) != sizeof(value) ||
+		value[2] == 0)
+		continue;
+	    count = (double)value[0] * value[1] / value[2];
+	    if (counts[i] < 0 || count < counts[i])
+		counts[i] = count;
+	}
+    }
+#else
+    (void)f;
+    (void)argp;
+    (void)n;
+#endif
+}
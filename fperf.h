@@ -0,0 +1,26 @@
+/*
+ * fperf.h - Count the hardware events of a test function f with the
+ *     performance counters of Linux, through perf_event_open(2)
+ */
+
+/* The events, in the order of their counts */
+#define FPERF_INSTRUCTIONS 0  /* instructions retired */
+#define FPERF_CACHE_MISSES 1  /* last-level cache misses */
+#define FPERF_DTLB_MISSES  2  /* data TLB load misses */
+#define FPERF_BRANCH_MISSES 3 /* mispredicted branches */
+#define FPERF_PAGE_FAULTS  4  /* page faults, counted by the kernel */
+#define FPERF_EVENTS       5
+
+/* Short names of the events, for column headings */
+extern const char *fperf_names[FPERF_EVENTS];
+
+/* The test function takes a generic pointer as input */
+typedef void (*fperf_test_funct)(void *);
+
+/* Open a counter for every event the machine and the kernel let us
+   count. Return how many there are */
+int init_fperf(void);
+
+/* Count the events of f(argp), as the least of n runs. The count of an
+   event that can't be counted is negative */
+void fperf(fperf_test_funct f, void *argp, int n, double counts[FPERF_EVENTS]);
@@ -0,0 +1,213 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+#######################################################################
+# gen_classes - size class table generator for mm-double.c
+#
+# This script reads Malloc Lab trace files, makes a histogram of the
+# payload sizes they request, and outputs a C header that partitions
+# the sizes below the large class into the classes mm-double.c uses
+# when built with CLASS_TABLE.
+#
+# The classes are chosen by dynamic programming to minimize what the
+# traces would cost, supposing the free blocks of a class are sized
+# like the requests of that class. A request costs the free blocks
+# looked at to find a fit, plus the units of the split-off rest of the
+# fitting block, weighted by -w. A class of a single size costs one
+# step per request and wastes nothing, so frequent sizes tend to get
+# classes of their own.
+#
+# The defaults match the default build of mm-double.c, where FOOTERS_FREE
+# makes every payload at least 2 units and slabs serve every request of
+# up to 64 bytes.
+#
+#######################################################################
+
+$| = 1; # autoflush output on every print statement
+
+#
+# void usage(void) - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] [-n <classes>] [-m <units>] [-u <bytes>] [-f <footers>] [-s <bytes>] [-S] [-w <weight>] <tracefile>...\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h          Print this message\n";
+    printf STDERR "  -n <n>      Partition into n classes besides the large class (default 10)\n";
+    printf STDERR "  -m <units>  Payloads of at least this many units are large (default 64)\n";
+    printf STDERR "  -u <bytes>  Bytes in a unit, UNIT_BYTES of mm-double.c (default 8)\n";
+    printf STDERR "  -f <f>      FOOTERS of mm-double.c, ALL, FREE or NONE (default FREE)\n";
+    printf STDERR "  -s <bytes>  Leave out requests of at most this many bytes\n";
+    printf STDERR "              (default 64, those that slabs serve, or 0 with -S)\n";
+    printf STDERR "  -S          mm-double.c has no slabs, with NO_SLABS, THREADS or ARENAS\n";
+    printf STDERR "  -w <w>      Weight of a unit split off against a step (default 1)\n";
+    die "\n" ;
+}
+
+##############
+# Main routine
+##############
+
+#
+# Parse and check the command line arguments
+#
+getopts('hn:m:u:f:s:Sw:');
+if ($opt_h) {
+    usage("");
+}
+$num_classes = defined($opt_n) ? $opt_n : 10;
+$max_units = defined($opt_m) ? $opt_m : 64;
+$unit_bytes = defined($opt_u) ? $opt_u : 8;
+$footers = defined($opt_f) ? uc($opt_f) : "FREE";
+$min_bytes = defined($opt_s) ? $opt_s : ($opt_S ? 0 : 64);
+$weight = defined($opt_w) ? $opt_w : 1;
+if (!@ARGV) {
+    usage("Missing trace files");
+}
+if ($num_classes < 1 || $num_classes > 31) {
+    usage("There must be 1 to 31 classes besides the large class");
+}
+if ($footers ne "ALL" && $footers ne "FREE" && $footers ne "NONE") {
+    usage("The footers must be ALL, FREE or NONE");
+}
+# the footer of a free block must still fit once an allocated one is freed
+$min_units = $footers eq "FREE" ? 2 : 1;
+if ($max_units < $min_units + 1 || $max_units > 256) {
+    usage("The large class must start at " . ($min_units + 1) . " to 256 units");
+}
+if ($num_classes > $max_units - $min_units) {
+    $num_classes = $max_units - $min_units;
+}
+
+#
+# H{u} is the number of requests for a payload of u units,
+# from min_units up
+#
+@H = (0) x $max_units;
+$requests = 0;
+foreach $file (@ARGV) {
+    open(TRACE, "<", $file) or die "$0: Could not open $file: $!\n";
+
+    # skip the trace header values
+    for ($i = 0; $i < 4; $i++) {
+	<TRACE>;
+    }
+
+    while ($line = <TRACE>) {
+	($cmd, $id, $size) = split(" ", $line);
+	if ($cmd ne "a" && $cmd ne "r") {
+	    next;
+	}
+	if ($size <= $min_bytes || $size == 0) {
+	    next;
+	}
+	$units = int(($size + $unit_bytes - 1) / $unit_bytes);
+	if ($units < $min_units) {
+	    $units = $min_units;
+	}
+	if ($units < $max_units) {
+	    $H[$units]++;
+	}
+	$requests++;
+    }
+    close(TRACE);
+}
+
+#
+# cost[a][b] is the cost of a class of the payloads a to b units.
+# For each b, both terms are accumulated as a goes down:
+#   steps = H(a..b) * sum over u of H[u] / H(u..b)
+#   split = sum over u of H[u] * (mean size of u..b - u)
+#
+for ($b = $min_units; $b < $max_units; $b++) {
+    $count = 0; # requests of u..b
+    $total = 0; # units they asked for
+    $ratio = 0;
+    $split = 0;
+    for ($a = $b; $a >= $min_units; $a--) {
+	$count += $H[$a];
+	$total += $a * $H[$a];
+	if ($H[$a]) {
+	    $ratio += $H[$a] / $count;
+	    $split += $H[$a] * ($total / $count - $a);
+	}
+	$cost[$a][$b] = $count * $ratio + $weight * $split;
+    }
+}
+
+#
+# best[k][b] is the least cost of covering min_units to b units with k classes,
+# and first[k][b] is where the last of those classes starts
+#
+for ($b = $min_units; $b < $max_units; $b++) {
+    $best[1][$b] = $cost[$min_units][$b];
+    $first[1][$b] = $min_units;
+}
+for ($k = 2; $k <= $num_classes; $k++) {
+    for ($b = $min_units + $k - 1; $b < $max_units; $b++) {
+	$best[$k][$b] = -1;
+	for ($a = $min_units + $k - 1; $a <= $b; $a++) {
+	    $c = $best[$k - 1][$a - 1] + $cost[$a][$b];
+	    if ($best[$k][$b] < 0 || $c < $best[$k][$b]) {
+		$best[$k][$b] = $c;
+		$first[$k][$b] = $a;
+	    }
+	}
+    }
+}
+
+# Walk the choices back from the last class
+$b = $max_units - 1;
+for ($k = $num_classes; $k >= 1; $k--) {
+    $lo[$k - 1] = $first[$k][$b];
+    $hi[$k - 1] = $b;
+    $b = $first[$k][$b] - 1;
+}
+
+# The classes of a single size at the start are the small classes
+for ($small = 0; $small < $num_classes && $lo[$small] == $hi[$small]; $small++) {
+}
+
+#
+# Print the header
+#
+printf "/*\n";
+printf " * classes.h - the size classes of mm-double.c built with CLASS_TABLE.\n";
+printf " *\n";
+printf " * Generated by gen_classes.pl from %d requests of\n", $requests;
+foreach $file (@ARGV) {
+    printf " *   %s\n", $file;
+}
+printf " * in %d-byte units, with FOOTERS_%s, leaving out those of at most %d bytes,\n", $unit_bytes, $footers, $min_bytes;
+printf " * with an estimated cost of %.0f.\n", $best[$num_classes][$max_units - 1];
+printf " *\n";
+for ($k = 0; $k < $num_classes; $k++) {
+    printf " * class %2d: %s%d units\n", $k,
+	$lo[$k] == $hi[$k] ? "" : "$lo[$k]-", $hi[$k];
+}
+printf " * class %2d: >=%d units\n", $num_classes, $max_units;
+printf " */\n";
+printf "#define CLASS_TABLE_UNIT_BYTES %d\n", $unit_bytes;
+printf "#define CLASS_TABLE_UNITS %d // payloads of as many units or more are large\n", $max_units;
+printf "#define SMALL_CLASSES %d\n", $small;
+printf "#define MEDIUM_CLASSES %d\n", $num_classes - $small;
+printf "\n";
+printf "// the class of a payload of each number of units\n";
+printf "static const unsigned char class_table[CLASS_TABLE_UNITS] = {\n";
+$line = "  0,";
+for ($u = 1; $u < $min_units; $u++) {
+    $line .= " 0,"; # no payload is this small
+}
+for ($k = 0; $k < $num_classes; $k++) {
+    for ($u = $lo[$k]; $u <= $hi[$k]; $u++) {
+	if (length($line) + length(" $k,") > 78) {
+	    printf "%s\n", $line;
+	    $line = " ";
+	}
+	$line .= " $k,";
+    }
+}
+printf "%s\n", $line;
+printf "};\n";
+exit;
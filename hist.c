@@ -0,0 +1,87 @@
+/****************************************
+ * Log-linear histograms of latencies
+ ****************************************/
+#include <string.h>
+#include <math.h>
+#include "hist.h"
+
+static int bucket_of(unsigned long long v);
+static unsigned long long bucket_hi(int b);
+
+/*
+ * hist_init - empty a histogram
+ */
+void hist_init(hist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/*
+ * bucket_of - the bucket that a value falls in
+ */
+static int bucket_of(unsigned long long v)
+{
+    int e;
+
+    if (v < HIST_LINEAR)
+	return (int)v;
+    e = 63 - __builtin_clzll(v);  /* the highest set bit */
+    return HIST_LINEAR + (e - HIST_SUB_BITS - 1) * (1 << HIST_SUB_BITS)
+	+ (int)((v >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+/*
+ * bucket_hi - the largest value that falls in a bucket
+ */
+static unsigned long long bucket_hi(int b)
+{
+    int e, sub;
+
+    if (b < HIST_LINEAR)
+	return b;
+    e = (b - HIST_LINEAR) / (1 << HIST_SUB_BITS) + HIST_SUB_BITS + 1;
+    sub = (b - HIST_LINEAR) % (1 << HIST_SUB_BITS);
+    return (((1ULL << HIST_SUB_BITS) + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+/*
+ * hist_add - add a latency to a histogram, counting negative ones
+ *     (from overhead compensation) as 0
+ */
+void hist_add(hist_t *h, double cycles)
+{
+    if (cycles < 0)
+	cycles = 0;
+    h->count[bucket_of((unsigned long long)cycles)]++;
+    h->total++;
+    if (cycles > h->max)
+	h->max = cycles;
+}
+
+/*
+ * hist_percentile - return a bound on the latency that p (0 to 1) of
+ *     the values are at or below: the top of the bucket that holds the
+ *     nearest rank, ceil(p * total), but never more than the largest value
+ */
+double hist_percentile(const hist_t *h, double p)
+{
+    unsigned long rank, seen = 0;
+    double hi;
+    int b;
+
+    if (h->total == 0)
+	return 0;
+    rank = (unsigned long)ceil(p * h->total);
+    if (rank < 1)
+	rank = 1;
+    if (rank > h->total)
+	rank = h->total;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+	seen += h->count[b];
+	if (seen >= rank)
+	    break;
+    }
+    hi = (double)bucket_hi(b);
+    return hi < h->max ? hi : h->max;
+}
@@ -0,0 +1,22 @@
+/*
+ * hist.h - Log-linear histograms of latencies, in cycles
+ */
+
+/* 
+ * Values below HIST_LINEAR get a bucket each. Above that, every power
+ * of 2 is split into 2^HIST_SUB_BITS buckets, so a bucket is never
+ * wider than 1/8 of its values.
+ */
+#define HIST_SUB_BITS 3
+#define HIST_LINEAR   (2 << HIST_SUB_BITS)
+#define HIST_BUCKETS  (HIST_LINEAR + (64 - HIST_SUB_BITS - 1) * (1 << HIST_SUB_BITS))
+
+typedef struct {
+    unsigned long count[HIST_BUCKETS];
+    unsigned long total;  /* number of values added */
+    double max;           /* largest value added */
+} hist_t;
+
+void hist_init(hist_t *h);
+void hist_add(hist_t *h, double cycles);
+double hist_percentile(const hist_t *h, double p);
@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE  /* for sched_getcpu and sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -15,10 +16,23 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <math.h>
+#include <limits.h>
+#include <search.h>
+#include <sched.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "fperf.h"
+#include "clock.h"
+#include "hist.h"
+#include "workload.h"
+#include "capture.h"
 #include "config.h"
 
 /**********************
@@ -29,9 +43,15 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MAXJOBS       64 /* max number of threads for -j */
+#define JOBRUNS        3 /* a -j measurement is the best of this many runs */
+#define PERFRUNS       3 /* a -P count is the least of this many runs */
+#define BENCHWARMUPS   2 /* runs of a trace before -b starts timing it */
+#define NUM_OPTYPES    3 /* ALLOC, FREE and REALLOC */
+#define TRACE_MAGIC "mmtrace2" /* the first bytes of a binary trace file */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
@@ -39,18 +59,42 @@
 
 /* Records the extent of each block's payload */
 typedef struct range_t {
-    char *lo;              /* low payload address */
-    char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    char *lo;               /* low payload address */
+    char *hi;               /* high payload address */
+    unsigned priority;      /* treap priority, above those of the children */
+    struct range_t *left;   /* ranges of lower addresses */
+    struct range_t *right;  /* ranges of higher addresses */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/* 
+ * Characterizes a single trace operation (allocator request). The
+ * requests of a batch are allocs or frees of the ids that follow the
+ * first one's, every one of them but the last with batch set.
+ */
+enum {ALLOC, FREE, REALLOC};
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
+    unsigned type: 2;                 /* type of request */
+    unsigned batch: 1;                /* the next request is of the same batch */
+    unsigned index: 29;               /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
 } traceop_t;
 
+/* 
+ * A binary trace file is this header followed by the requests as
+ * they are in memory, so that it can be mapped and replayed as it is.
+ * TRACE_MAGIC and the size of a request tell it from a text trace, and
+ * from one written by an mdriver of a different build.
+ */
+typedef struct {
+    char magic[8];
+    int op_bytes;        /* sizeof(traceop_t) */
+    int sugg_heapsize;
+    int num_ids;
+    int num_ops;
+    int weight;
+    int padding;         /* keeps the requests 8-byte aligned */
+} tracehdr_t;
+
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
@@ -60,8 +104,16 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* the mapping of a binary trace file, or NULL */
+    size_t map_bytes;
 } trace_t;
 
+/* A block of a capture, looked up by its address as it is converted */
+typedef struct {
+    uint64_t ptr;        /* address in the captured program */
+    int size;
+} capblock_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -72,6 +124,83 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* How the threads of a -j run share a trace */
+typedef enum {
+    JOB_REPLICA,   /* every thread replays its own copy of the trace */
+    JOB_PARTITION  /* thread k replays the blocks whose index is k mod n */
+} jobmode_t;
+
+/* Blocks a thread frees on behalf of another (-c), in FIFO order */
+typedef struct {
+    char **blocks;  /* big enough that it never wraps around */
+    int head;       /* next block to free, only touched by the consumer */
+    int tail;       /* next free slot, only written by the producer */
+} jobqueue_t;
+
+/* The params and results of one thread of a -j run */
+typedef struct {
+    trace_t *trace;
+    int id;               /* which of the num_jobs threads this is */
+    int num_jobs;
+    jobmode_t mode;
+    pthread_barrier_t *barrier; /* lines the threads up to start and drain */
+    jobqueue_t *queues;   /* one per thread if frees are handed off, or NULL */
+    char **blocks;        /* the thread's own copy of trace->blocks */
+    double ops;           /* number of requests the thread made */
+    int failed;           /* did the heap run out under the thread? */
+    struct timespec start, end;
+} job_t;
+
+/* Summarizes a trace running on many threads against the same on one */
+typedef struct {
+    double ops1, secs1;   /* -j 1 */
+    double ops, secs;     /* -j n */
+    double min_lat;       /* fastest thread of -j n, in ns per request */
+    double max_lat;       /* slowest thread of -j n */
+} jobstats_t;
+
+/* Summarizes the reallocs of a trace (-R) */
+typedef struct {
+    double ops;      /* number of reallocs in the trace */
+    double secs;     /* time spent in them alone */
+    double moved;    /* reallocs that returned another address */
+    double remapped; /* ... from one mapping to another, without a copy */
+    double copied;   /* bytes the other moves had to preserve */
+} reallocstats_t;
+
+/* Summarizes the -b runs of a trace, in seconds a run */
+typedef struct {
+    int runs;        /* 0 if the trace wasn't run */
+    double median;
+    double lo, hi;   /* 95% confidence interval of the median */
+} benchstats_t;
+
+/* The results of a trace in a -b results file */
+typedef struct {
+    char name[MAXLINE];
+    benchstats_t bench;
+    double util;
+} baseline_t;
+
+/* Where the timeline of the heap goes (-T), and how often it is sampled */
+typedef struct {
+    FILE *file;
+    int json;        /* JSON rather than CSV */
+    int every;       /* sample after this many requests (-N) */
+    int num_classes; /* of mm.c, from its first walk: -1 before it, and
+			-2 if mm.c can't walk its heap */
+    int samples;     /* written so far */
+} timeline_t;
+
+/* Adds up a sample of the timeline from the walk of the heap */
+typedef struct {
+    int num_classes;
+    double alloc;    /* payload bytes of the allocated blocks */
+    double free;     /* ... of the free blocks */
+    double largest;  /* ... of the largest free block */
+    double class_free[MM_STATS_CLASSES + 1]; /* free bytes by class, then in none */
+} sample_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -82,6 +211,9 @@ typedef struct {
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* defined only with -P */
+    double events[FPERF_EVENTS]; /* hardware events (negative if not counted) */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
@@ -95,6 +227,21 @@ char msg[MAXLINE];      /* for whenever we need to compose an error message */
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* If set, the trace names are workload specs to generate instead (-w) */
+static int generated = 0;
+
+/* If set, frees pass the size of the block to mm_free_sized (-S) */
+static int sized = 0;
+
+/* If set, mallocs are mm_memalign's of this alignment (-A) */
+static size_t alignment = 0;
+
+/* If set, mallocs are mm_calloc's, whose blocks must be zero (-z) */
+static int zeroed = 0;
+
+/* The names of the request types, for printing */
+static char *optype_names[NUM_OPTYPES] = {"malloc", "free", "realloc"};
+
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
@@ -105,7 +252,7 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
@@ -113,6 +260,11 @@ static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static trace_t *gen_trace(char *spec);
+static int map_trace(trace_t *trace, char *path);
+static int read_capture(trace_t *trace, char *path);
+static void write_trace(trace_t *trace, char *path);
+static int batch_length(trace_t *trace, int i);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -121,12 +273,53 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
+static void *alloc_block(int size);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
 
+/* Routines for measuring the scaling of the mm malloc package over
+   many threads (-j) */
+static double eval_mm_jobs(trace_t *trace, int num_jobs, jobmode_t mode,
+			   int handoff, double *ops, double *min_lat,
+			   double *max_lat);
+static void *eval_mm_job(void *ptr);
+static void free_handoffs(job_t *job);
+
+/* Routine for measuring the latency of every request of the mm malloc
+   package with the cycle counter (-H) */
+static void eval_mm_latency(trace_t *trace, hist_t hists[NUM_OPTYPES]);
+
+/* Routine for measuring the throughput and copy volume of the reallocs
+   of the mm malloc package (-R) */
+static void eval_mm_realloc(trace_t *trace, reallocstats_t *rs);
+
+/* Routines for benchmarking the mm malloc package with repeated runs
+   of each trace, against the results of an earlier benchmark (-b) */
+static void pin_cpu(void);
+static void eval_mm_bench(speed_t *params, int runs, benchstats_t *bs);
+static int cmp_double(const void *a, const void *b);
+static int read_baseline(char *path, baseline_t **base);
+static void write_bench(char *path, int n, char **names, stats_t *stats,
+			benchstats_t *bstats);
+static int printbenchresults(int n, char **names, stats_t *stats,
+			     benchstats_t *bstats, char *basefile,
+			     double threshold);
+
+/* Routines for sampling the fragmentation of the heap of the mm malloc
+   package every so many requests (-T) */
+static void eval_mm_timeline(trace_t *trace, int tracenum, timeline_t *tl);
+static void sample_block(const mm_block_t *block, void *arg);
+static void write_sample(timeline_t *tl, int tracenum, int opnum, double live);
+
 /* Various helper routines */
-static void printresults(int n, stats_t *stats);
+static void printresults(int n, stats_t *stats, int perf);
+static void printjobresults(int n, int num_jobs, jobstats_t *stats);
+static void printlatresults(int n, stats_t *stats,
+			    hist_t (*hists)[NUM_OPTYPES]);
+static void printreallocresults(int n, stats_t *stats,
+				reallocstats_t *rstats);
+static void printcounters(int tracenum);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -146,10 +339,31 @@ int main(int argc, char **argv)
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    jobstats_t *job_stats = NULL; /* -j stats for each trace */
+    hist_t (*mm_hists)[NUM_OPTYPES] = NULL; /* -H latencies for each trace */
+    reallocstats_t *realloc_stats = NULL; /* -R stats for each trace */
+    benchstats_t *bench_stats = NULL; /* -b stats for each trace */
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int num_jobs = 0;    /* If set, also run on this many threads (-j) */
+    jobmode_t job_mode = JOB_REPLICA; /* How threads share a trace (-p) */
+    int handoff = 0;     /* If set, threads free each other's blocks (-c) */
+    int latency = 0;     /* If set, measure the latency of every request (-H) */
+    int reallocs = 0;    /* If set, measure the reallocs on their own (-R) */
+    int counters = 0;    /* If set, print the counters of mm.c (-s) */
+    int perf = 0;        /* If set, count hardware events per request (-P) */
+    size_t max_heap = MAX_HEAP; /* Size of the simulated heap (-m) */
+    int huge = 0;        /* If set, back the heap with huge pages (-L) */
+    char *binfile = NULL; /* If set, write the trace to this binary file (-B) */
+    char *timefile = NULL; /* If set, write the heap timeline to this file (-T) */
+    timeline_t timeline = {NULL, 0, 1000, -1, 0}; /* -T, sampled every -N requests */
+    int bench_runs = 0;  /* If set, benchmark every trace with this many runs (-b) */
+    char *benchfile = NULL; /* If set, write the -b results to this file (-o) */
+    char *basefile = NULL;  /* If set, compare the -b results to this file (-r) */
+    double threshold = 5;   /* Slowdown in percent that -r calls a regression (-x) */
+    int regressions = 0;    /* number of traces that regressed against -r */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,12 +372,16 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:w:j:m:A:B:T:N:b:o:r:x:pcHPRSsLhvVgalz")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
 	    break;
         case 'f': /* Use one specific trace file only (relative to curr dir) */
+            if (generated) {
+                fprintf(stderr, "ERROR: -f and -w don't go together\n");
+                exit(1);
+            }
             num_tracefiles = 1;
             if ((tracefiles = realloc(tracefiles, 2*sizeof(char *))) == NULL)
 		unix_error("ERROR: realloc failed in main");
@@ -171,8 +389,19 @@ int main(int argc, char **argv)
             tracefiles[0] = strdup(optarg);
             tracefiles[1] = NULL;
             break;
+        case 'w': /* Generate a workload, as many times as given */
+            if (num_tracefiles > 0 && !generated) {
+                fprintf(stderr, "ERROR: -f and -w don't go together\n");
+                exit(1);
+            }
+            generated = 1;
+            if ((tracefiles = realloc(tracefiles, (num_tracefiles + 2)*sizeof(char *))) == NULL)
+		unix_error("ERROR: realloc failed in main");
+            tracefiles[num_tracefiles++] = strdup(optarg);
+            tracefiles[num_tracefiles] = NULL;
+            break;
 	case 't': /* Directory where the traces are located */
-	    if (num_tracefiles == 1) /* ignore if -f already encountered */
+	    if (num_tracefiles > 0) /* ignore if -f or -w already encountered */
 		break;
 	    strcpy(tracedir, optarg);
 	    if (tracedir[strlen(tracedir)-1] != '/') 
@@ -184,6 +413,84 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'j': /* Also replay each trace on this many threads */
+            num_jobs = atoi(optarg);
+            if (num_jobs < 1 || num_jobs > MAXJOBS) {
+                fprintf(stderr, "ERROR: -j takes 1 to %d threads\n", MAXJOBS);
+                exit(1);
+            }
+            break;
+        case 'p': /* Partition each trace between the threads */
+            job_mode = JOB_PARTITION;
+            break;
+        case 'c': /* Free every block on another thread than malloc'd it */
+            handoff = 1;
+            break;
+        case 'H': /* Histogram the latency of every request */
+            latency = 1;
+            break;
+        case 'P': /* Count the hardware events of every trace */
+            perf = 1;
+            break;
+        case 'R': /* Time the reallocs and count what they copy */
+            reallocs = 1;
+            break;
+        case 'S': /* Free with mm_free_sized */
+            sized = 1;
+            break;
+        case 'A': /* Allocate with mm_memalign */
+            alignment = strtoul(optarg, NULL, 0);
+            if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+                fprintf(stderr, "ERROR: -A takes a power of 2\n");
+                exit(1);
+            }
+            break;
+        case 'z': /* Allocate with mm_calloc */
+            zeroed = 1;
+            break;
+        case 's': /* Print the allocator's own counters */
+            counters = 1;
+            break;
+        case 'm': /* Size of the simulated heap in MB */
+            if (atoi(optarg) < 1) {
+                fprintf(stderr, "ERROR: -m takes a positive number of MB\n");
+                exit(1);
+            }
+            max_heap = (size_t)atoi(optarg) << 20;
+            break;
+        case 'L': /* Back the heap with huge pages */
+            huge = 1;
+            break;
+        case 'B': /* Convert the trace of -f or -w to a binary trace file */
+            binfile = optarg;
+            break;
+        case 'T': /* Write a timeline of the fragmentation of the heap */
+            timefile = optarg;
+            break;
+        case 'N': /* Sample the timeline every so many requests */
+            if ((timeline.every = atoi(optarg)) < 1) {
+                fprintf(stderr, "ERROR: -N takes a positive number of requests\n");
+                exit(1);
+            }
+            break;
+        case 'b': /* Benchmark every trace with this many timed runs */
+            if ((bench_runs = atoi(optarg)) < 1) {
+                fprintf(stderr, "ERROR: -b takes a positive number of runs\n");
+                exit(1);
+            }
+            break;
+        case 'o': /* Write the benchmark results to a file */
+            benchfile = optarg;
+            break;
+        case 'r': /* Compare the benchmark results to an earlier file of them */
+            basefile = optarg;
+            break;
+        case 'x': /* Slowdown in percent that is a regression */
+            if ((threshold = atof(optarg)) < 0) {
+                fprintf(stderr, "ERROR: -x takes a percentage of at least 0\n");
+                exit(1);
+            }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -199,6 +506,20 @@ int main(int argc, char **argv)
         }
     }
 	
+    /*
+     * Convert the one trace to a binary trace file instead of running it
+     */
+    if (binfile != NULL) {
+	if (tracefiles == NULL) {
+	    fprintf(stderr, "ERROR: -B needs the trace to convert given with -f or -w\n");
+	    exit(1);
+	}
+	trace = read_trace(tracedir, tracefiles[0]);
+	write_trace(trace, binfile);
+	free_trace(trace);
+	exit(0);
+    }
+
     /* 
      * Check and print team info 
      */
@@ -237,6 +558,10 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (perf && init_fperf() == 0) {
+	fprintf(stderr, "ERROR: -P found no events that perf_event_open can count\n");
+	exit(1);
+    }
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -262,14 +587,17 @@ int main(int argc, char **argv)
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		if (perf)
+		    fperf(eval_libc_speed, &speed_params, PERFRUNS,
+			  libc_stats[i].events);
 	    }
 	    free_trace(trace);
 	}
 
 	/* Display the libc results in a compact table */
-	if (verbose) {
+	if (verbose || perf) {
 	    printf("\nResults for libc malloc:\n");
-	    printresults(num_tracefiles, libc_stats);
+	    printresults(num_tracefiles, libc_stats, perf);
 	}
     }
 
@@ -283,10 +611,53 @@ int main(int argc, char **argv)
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
+    if (num_jobs) {
+	job_stats = (jobstats_t *)calloc(num_tracefiles, sizeof(jobstats_t));
+	if (job_stats == NULL)
+	    unix_error("job_stats calloc in main failed");
+    }
+    if (latency) {
+	mm_hists = calloc(num_tracefiles, sizeof(*mm_hists));
+	if (mm_hists == NULL)
+	    unix_error("mm_hists calloc in main failed");
+    }
+    if (reallocs) {
+	realloc_stats = calloc(num_tracefiles, sizeof(reallocstats_t));
+	if (realloc_stats == NULL)
+	    unix_error("realloc_stats calloc in main failed");
+    }
     
+    if ((benchfile != NULL || basefile != NULL) && !bench_runs) {
+	fprintf(stderr, "ERROR: -o and -r need -b\n");
+	exit(1);
+    }
+    if (alignment && zeroed) {
+	fprintf(stderr, "ERROR: -A and -z can't both be given\n");
+	exit(1);
+    }
+    if (bench_runs) {
+	bench_stats = calloc(num_tracefiles, sizeof(benchstats_t));
+	if (bench_stats == NULL)
+	    unix_error("bench_stats calloc in main failed");
+	pin_cpu();
+    }
+
     /* Initialize the simulated memory system in memlib.c */
+    mem_configure(max_heap, huge);
     mem_init(); 
 
+    /* A name ending in .json asks for a JSON timeline, any other for CSV */
+    if (timefile != NULL) {
+	if ((timeline.file = fopen(timefile, "w")) == NULL) {
+	    sprintf(msg, "Could not open %s for -T", timefile);
+	    unix_error(msg);
+	}
+	timeline.json = strlen(timefile) >= 5 &&
+	    !strcmp(timefile + strlen(timefile) - 5, ".json");
+	if (timeline.json)
+	    fprintf(timeline.file, "[");
+    }
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
@@ -294,6 +665,8 @@ int main(int argc, char **argv)
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
 	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	if (mm_stats[i].valid && counters)
+	    printcounters(i);
 	if (mm_stats[i].valid) {
 	    if (verbose > 1)
 		printf("efficiency, ");
@@ -303,17 +676,92 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (perf) {
+		if (verbose > 1)
+		    printf("Counting the hardware events.\n");
+		fperf(eval_mm_speed, &speed_params, PERFRUNS, mm_stats[i].events);
+	    }
+	    if (latency) {
+		if (verbose > 1)
+		    printf("Measuring the latency of every request.\n");
+		eval_mm_latency(trace, mm_hists[i]);
+	    }
+	    if (reallocs) {
+		if (verbose > 1)
+		    printf("Measuring the reallocs.\n");
+		eval_mm_realloc(trace, &realloc_stats[i]);
+	    }
+	    if (bench_runs) {
+		if (verbose > 1)
+		    printf("Benchmarking with %d runs.\n", bench_runs);
+		eval_mm_bench(&speed_params, bench_runs, &bench_stats[i]);
+	    }
+	    if (timeline.file != NULL && timeline.num_classes != -2) {
+		if (verbose > 1)
+		    printf("Sampling the heap every %d requests.\n", timeline.every);
+		eval_mm_timeline(trace, i, &timeline);
+	    }
+	    if (num_jobs) {
+		jobstats_t *js = &job_stats[i];
+		if (verbose > 1)
+		    printf("Measuring scaling over %d threads.\n", num_jobs);
+		js->secs1 = eval_mm_jobs(trace, 1, job_mode, handoff,
+					 &js->ops1, &js->min_lat, &js->max_lat);
+		js->secs = eval_mm_jobs(trace, num_jobs, job_mode, handoff,
+					&js->ops, &js->min_lat, &js->max_lat);
+	    }
 	}
 	free_trace(trace);
     }
+    if (timeline.file != NULL) {
+	if (timeline.json)
+	    fprintf(timeline.file, "\n]\n");
+	if (fclose(timeline.file) != 0)
+	    unix_error("Could not write the timeline of -T");
+    }
 
     /* Display the mm results in a compact table */
-    if (verbose) {
+    if (verbose || perf) {
 	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
+	printresults(num_tracefiles, mm_stats, perf);
+	printf("\n");
+    }
+
+    /* Like the scaling results, the latencies are displayed if asked for */
+    if (latency) {
+	printf("Latency in cycles for mm malloc:\n");
+	printlatresults(num_tracefiles, mm_stats, mm_hists);
+	printf("\n");
+    }
+
+    /* So are the realloc results */
+    if (reallocs) {
+	printf("Reallocs of mm malloc:\n");
+	printreallocresults(num_tracefiles, mm_stats, realloc_stats);
+	printf("\n");
+    }
+
+    /* The scaling results are always displayed, since they were asked for */
+    if (num_jobs) {
+	printf("Results for mm malloc on %d threads (%s%s):\n", num_jobs,
+	       job_mode == JOB_PARTITION ? "partitioned" : "replicated",
+	       handoff ? ", frees handed off" : "");
+	printjobresults(num_tracefiles, num_jobs, job_stats);
 	printf("\n");
     }
 
+    /* So are the benchmark results, which fail the run if they regressed */
+    if (bench_runs) {
+	printf("Benchmark of mm malloc (median of %d runs, 95%% confidence):\n",
+	       bench_runs);
+	regressions = printbenchresults(num_tracefiles, tracefiles, mm_stats,
+					bench_stats, basefile, threshold);
+	printf("\n");
+	if (benchfile != NULL)
+	    write_bench(benchfile, num_tracefiles, tracefiles, mm_stats,
+			bench_stats);
+    }
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -362,21 +810,111 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    if (regressions) {
+	printf("%d traces regressed by more than %.1f%% against %s\n",
+	       regressions, threshold, basefile);
+	exit(1);
+    }
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
+ *
+ * The tree is a treap: a binary search tree on the low payload
+ * addresses that is also a heap on random priorities, so it stays
+ * balanced in expectation whatever order the traces ask in, and
+ * adding, checking and removing a range take O(log n) time.
  ****************************************************************/
 
+/*
+ * range_priority - Return a pseudorandom priority for a new range.
+ *     The generator is our own so that it leaves rand() to the traces.
+ */
+static unsigned range_priority(void)
+{
+    static unsigned state = 2463534242u;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/*
+ * find_range - Return the range with the highest low address at or
+ *     below addr, or NULL if there is none.
+ */
+static range_t *find_range(range_t *p, char *addr)
+{
+    range_t *found = NULL;
+
+    while (p != NULL) {
+	if (p->lo <= addr) {
+	    found = p;
+	    p = p->right;
+	}
+	else
+	    p = p->left;
+    }
+    return found;
+}
+
+/*
+ * insert_range - Insert range r into the treap rooted at *pp
+ */
+static void insert_range(range_t **pp, range_t *r)
+{
+    range_t *p = *pp;
+
+    if (p == NULL) {
+	*pp = r;
+	return;
+    }
+    if (r->lo < p->lo) {
+	insert_range(&p->left, r);
+	if (p->left->priority > p->priority) { /* rotate right */
+	    *pp = p->left;
+	    p->left = (*pp)->right;
+	    (*pp)->right = p;
+	}
+    }
+    else {
+	insert_range(&p->right, r);
+	if (p->right->priority > p->priority) { /* rotate left */
+	    *pp = p->right;
+	    p->right = (*pp)->left;
+	    (*pp)->left = p;
+	}
+    }
+}
+
+/*
+ * merge_ranges - Join two treaps, where every range of left lies
+ *     below every range of right, and return the root of the result.
+ */
+static range_t *merge_ranges(range_t *left, range_t *right)
+{
+    if (left == NULL)
+	return right;
+    if (right == NULL)
+	return left;
+    if (left->priority > right->priority) {
+	left->right = merge_ranges(left->right, right);
+	return left;
+    }
+    right->left = merge_ranges(left, right->left);
+    return right;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
@@ -395,36 +933,40 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or of a mapping */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_is_mapped(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. Since those
+     * don't overlap each other, only the last one starting at or
+     * below hi can reach into this one.
+     */
+    if ((p = find_range(*ranges, hi)) != NULL && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->priority = range_priority();
+    p->left = NULL;
+    p->right = NULL;
+    insert_range(ranges, p);
     return 1;
 }
 
@@ -433,18 +975,16 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+    range_t **pp = ranges;
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
+    while ((p = *pp) != NULL) {
         if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
+	    *pp = merge_ranges(p->left, p->right);
             free(p);
             break;
         }
-        prevpp = &(p->next);
+	pp = (lo < p->lo) ? &p->left : &p->right;
     }
 }
 
@@ -453,13 +993,13 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    free(p);
     *ranges = NULL;
 }
 
@@ -477,20 +1017,28 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, count, k;
     unsigned max_index = 0;
     unsigned op_index;
 
+    if (generated)
+	return gen_trace(filename);
+
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
 
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
+    trace->map = NULL;
 	
-    /* Read the trace file header */
+    /* A binary trace needs no reading at all, and a capture is converted */
     strcpy(path, tracedir);
     strcat(path, filename);
+    if (map_trace(trace, path) || read_capture(trace, path))
+	return trace;
+
+    /* Read the trace file header */
     if ((tracefile = fopen(path, "r")) == NULL) {
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
@@ -523,6 +1071,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	case 'a':
 	    fscanf(tracefile, "%u %u", &index, &size);
 	    trace->ops[op_index].type = ALLOC;
+	    trace->ops[op_index].batch = 0;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
@@ -530,6 +1079,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	case 'r':
 	    fscanf(tracefile, "%u %u", &index, &size);
 	    trace->ops[op_index].type = REALLOC;
+	    trace->ops[op_index].batch = 0;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
@@ -537,7 +1087,30 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	case 'f':
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
+	    trace->ops[op_index].batch = 0;
 	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = 0;
+	    break;
+	case 'A': /* a batch of count allocs of ids from index on */
+	case 'F': /* ... and of frees */
+	    fscanf(tracefile, "%u %u", &index, &count);
+	    size = 0;
+	    if (type[0] == 'A')
+		fscanf(tracefile, "%u", &size);
+	    if (count == 0 || count > trace->num_ops - op_index) {
+		printf("Bogus batch of %u requests in tracefile %s\n",
+		       count, path);
+		exit(1);
+	    }
+	    for (k = 0; k < count; k++) {
+		trace->ops[op_index + k].type = (type[0] == 'A') ? ALLOC : FREE;
+		trace->ops[op_index + k].batch = k + 1 < count;
+		trace->ops[op_index + k].index = index + k;
+		trace->ops[op_index + k].size = size;
+	    }
+	    if (type[0] == 'A' && index + count - 1 > max_index)
+		max_index = index + count - 1;
+	    op_index += count - 1;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
@@ -554,13 +1127,331 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * gen_trace - generate the requests of a workload spec into a trace,
+ *     as read_trace would have read them from a trace file
+ */
+static trace_t *gen_trace(char *spec)
+{
+    trace_t *trace;
+    workload_t *wl;
+    wlop_t op;
+    char err[MAXLINE];
+    int i;
+
+    if (verbose > 1)
+	printf("Generating workload: %s\n", spec);
+
+    if ((wl = wl_create(spec, err, sizeof(err))) == NULL) {
+	printf("ERROR: %s\n", err);
+	exit(1);
+    }
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in gen_trace");
+    trace->map = NULL;
+    trace->num_ops = wl_num_ops(wl);
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in gen_trace");
+
+    /* The workload types are in the order of ours */
+    for (i = 0; wl_next(wl, &op); i++) {
+	trace->ops[i].type = op.type;
+	trace->ops[i].batch = 0;
+	trace->ops[i].index = op.index;
+	trace->ops[i].size = op.size;
+    }
+    assert(i == trace->num_ops);
+
+    trace->num_ids = wl_num_ids(wl);
+    trace->sugg_heapsize = (wl_peak_bytes(wl) > 0x7fffffff) ? 0x7fffffff :
+	(int)wl_peak_bytes(wl);
+    trace->weight = 1;
+    wl_free(wl);
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in gen_trace");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in gen_trace");
+    return trace;
+}
+
+/*
+ * map_trace - if path is a binary trace file, map it and point the
+ *     trace at the requests in it, allocating only the block arrays.
+ *     Returns 0 if it is a text trace file instead.
+ */
+static int map_trace(trace_t *trace, char *path)
+{
+    int fd;
+    struct stat st;
+    tracehdr_t *hdr;
+    traceop_t *ops;
+    int i;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    if (fstat(fd, &st) < 0)
+	unix_error("fstat failed in map_trace");
+    if ((size_t)st.st_size < sizeof(tracehdr_t)) {
+	close(fd);
+	return 0;
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+    if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0) {
+	munmap(hdr, st.st_size);
+	return 0;
+    }
+
+    if (hdr->op_bytes != sizeof(traceop_t) || hdr->num_ids < 0 || hdr->num_ops < 0 ||
+	(size_t)st.st_size < sizeof(tracehdr_t) + (size_t)hdr->num_ops * sizeof(traceop_t)) {
+	printf("Binary tracefile %s is truncated or from another build of mdriver\n", path);
+	exit(1);
+    }
+    /* the requests are only read from here on, so they are paged in as replayed */
+    madvise(hdr, st.st_size, MADV_SEQUENTIAL);
+
+    /* the replay trusts every index, and that the last batch ends */
+    ops = (traceop_t *)(hdr + 1);
+    for (i = 0; i < hdr->num_ops; i++) {
+	if (ops[i].type > REALLOC || ops[i].index >= (unsigned)hdr->num_ids ||
+	    (ops[i].batch && i == hdr->num_ops - 1)) {
+	    printf("Bogus request %d in binary tracefile %s\n", i, path);
+	    exit(1);
+	}
+    }
+
+    trace->map = hdr;
+    trace->map_bytes = st.st_size;
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = ops;
+
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in map_trace");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in map_trace");
+    return 1;
+}
+
+/*
+ * cmp_capture, cmp_capblock - orders of the records of a capture, by
+ *     time and then by their place in the file, and of its blocks
+ */
+static const caprec_t *capture_recs;
+
+static int cmp_capture(const void *a, const void *b)
+{
+    const caprec_t *x = &capture_recs[*(const unsigned *)a];
+    const caprec_t *y = &capture_recs[*(const unsigned *)b];
+
+    if (x->nsecs != y->nsecs)
+	return x->nsecs < y->nsecs ? -1 : 1;
+    return (x > y) - (x < y);
+}
+
+static int cmp_capblock(const void *a, const void *b)
+{
+    const capblock_t *x = a, *y = b;
+
+    return (x->ptr > y->ptr) - (x->ptr < y->ptr);
+}
+
+/* the blocks of the tree of a capture are in an array of their own */
+static void free_nothing(void *p)
+{
+    (void)p;
+}
+
+/*
+ * read_capture - if path is a capture of libmm.so (see shim.c), convert
+ *     its calls into requests in the order of their timestamps, giving
+ *     every block an id that is reused once it is freed. Calls that
+ *     can't be replayed are dropped: failed ones, and frees of blocks
+ *     allocated before the capture started or by libc. memalign and
+ *     calloc are replayed as allocs. Returns 0 if it is not a capture.
+ */
+static int read_capture(trace_t *trace, char *path)
+{
+    int fd;
+    struct stat st;
+    capthdr_t *hdr;
+    const caprec_t *rec;
+    unsigned *order, i, n, dropped = 0;
+    capblock_t *blocks, key, **found;
+    int *free_ids, num_free = 0, id, size;
+    void *root = NULL;
+    traceop_t *op;
+    long long live = 0, peak = 0;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    if (fstat(fd, &st) < 0)
+	unix_error("fstat failed in read_capture");
+    if ((size_t)st.st_size < sizeof(capthdr_t)) {
+	close(fd);
+	return 0;
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+	unix_error("mmap failed in read_capture");
+    if (memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) != 0) {
+	munmap(hdr, st.st_size);
+	return 0;
+    }
+    if (hdr->rec_bytes != sizeof(caprec_t)) {
+	printf("Capture %s is from another build of libmm.so\n", path);
+	exit(1);
+    }
+    if (verbose > 1)
+	printf("Converting capture of pid %u: %s\n", hdr->pid, path);
+
+    /* The buffers of the threads are in the file in any order */
+    capture_recs = (const caprec_t *)(hdr + 1);
+    n = (st.st_size - sizeof(capthdr_t)) / sizeof(caprec_t);
+    if ((order = (unsigned *)malloc(n * sizeof(unsigned) + 1)) == NULL)
+	unix_error("malloc 1 failed in read_capture");
+    for (i = 0; i < n; i++)
+	order[i] = i;
+    qsort(order, n, sizeof(unsigned), cmp_capture);
+
+    /* There are no more ids than calls */
+    if ((blocks = (capblock_t *)malloc(n * sizeof(capblock_t) + 1)) == NULL ||
+	(free_ids = (int *)malloc(n * sizeof(int) + 1)) == NULL ||
+	(trace->ops = (traceop_t *)malloc(n * sizeof(traceop_t) + 1)) == NULL)
+	unix_error("malloc 2 failed in read_capture");
+
+    trace->num_ids = 0;
+    op = trace->ops;
+    for (i = 0; i < n; i++) {
+	rec = &capture_recs[order[i]];
+	if (rec->type > CAPTURE_FREE ||
+	    (rec->type != CAPTURE_FREE && (rec->result == 0 || rec->size > INT_MAX))) {
+	    dropped++;
+	    continue;
+	}
+	size = (rec->size > 0) ? (int)rec->size : 1; /* as the shim allocated */
+
+	key.ptr = rec->ptr;
+	found = (rec->type == CAPTURE_REALLOC || rec->type == CAPTURE_FREE) ?
+	    tfind(&key, &root, cmp_capblock) : NULL;
+	if (found != NULL) {
+	    id = *found - blocks;
+	    live -= blocks[id].size;
+	    tdelete(&key, &root, cmp_capblock);
+	} else if (rec->type == CAPTURE_FREE) {
+	    dropped++;
+	    continue;
+	} else
+	    id = (num_free > 0) ? free_ids[--num_free] : trace->num_ids++;
+
+	op->batch = 0;
+	op->index = id;
+	op->size = 0;
+	if (rec->type == CAPTURE_FREE) {
+	    op->type = FREE;
+	    free_ids[num_free++] = id;
+	} else {
+	    /* a block still at the address lost its free, and stays allocated */
+	    key.ptr = rec->result;
+	    tdelete(&key, &root, cmp_capblock);
+	    blocks[id].ptr = rec->result;
+	    blocks[id].size = size;
+	    tsearch(&blocks[id], &root, cmp_capblock);
+	    op->type = (found != NULL) ? REALLOC : ALLOC;
+	    op->size = size;
+	    live += size;
+	    if (live > peak)
+		peak = live;
+	}
+	op++;
+    }
+    trace->num_ops = op - trace->ops;
+    if (verbose > 1 && dropped > 0)
+	printf("Dropped %u of the %u calls that can't be replayed\n", dropped, n);
+
+    tdestroy(root, free_nothing);
+    free(free_ids);
+    free(blocks);
+    free(order);
+    munmap(hdr, st.st_size);
+
+    trace->sugg_heapsize = (peak > INT_MAX) ? INT_MAX : (int)peak;
+    trace->weight = 1;
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *) + 1)) == NULL)
+	unix_error("malloc 3 failed in read_capture");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t) + 1)) == NULL)
+	unix_error("malloc 4 failed in read_capture");
+    return 1;
+}
+
+/*
+ * write_trace - write a trace out as a binary trace file
+ */
+static void write_trace(trace_t *trace, char *path)
+{
+    FILE *binfile;
+    tracehdr_t hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.op_bytes = sizeof(traceop_t);
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+
+    if ((binfile = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in write_trace", path);
+	unix_error(msg);
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, binfile) != 1 ||
+	fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, binfile) != (size_t)trace->num_ops ||
+	fclose(binfile) != 0) {
+	sprintf(msg, "Could not write %s in write_trace", path);
+	unix_error(msg);
+    }
+}
+
+/*
+ * batch_length - the number of requests of the batch that starts at
+ *     request i, or 1 if it is not in a batch
+ */
+static int batch_length(trace_t *trace, int i)
+{
+    int n = 1;
+
+    while (trace->ops[i + n - 1].batch)
+	n++;
+    return n;
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(),
+ *              unmapping the requests of a binary trace instead.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the three arrays... */
+	munmap(trace->map, trace->map_bytes);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -571,20 +1462,35 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * alloc_block - Allocate a block of size bytes for a trace, with
+ *     mm_memalign if -A gave an alignment, mm_calloc with -z, and
+ *     mm_malloc otherwise
+ */
+static void *alloc_block(int size)
+{
+    if (alignment)
+	return mm_memalign(alignment, size);
+    if (zeroed)
+	return mm_calloc(1, size);
+    return mm_malloc(size);
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
-    int i, j;
+    int i, j, n;
     int index;
     int size;
     int oldsize;
+    size_t usable;
     char *newp;
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -601,32 +1507,57 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_malloc */
+        case ALLOC: /* mm_malloc, or mm_malloc_batch for a batch */
 
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    /* Call the student's malloc, which remembers the regions */
+	    if ((n = batch_length(trace, i)) > 1) {
+		if (mm_malloc_batch(size, (void **)&trace->blocks[index], n) != (size_t)n) {
+		    malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		    return 0;
+		}
+	    }
+	    else if ((trace->blocks[index] = alloc_block(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
-	    
-	    /* 
-	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
-	     * and must not overlap any currently allocated block. 
-	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    else if (alignment && (size_t)trace->blocks[index] % alignment != 0) {
+		malloc_error(tracenum, i, "mm_memalign returned a misaligned block.");
 		return 0;
+	    }
+	    else if (zeroed) {
+		for (p = trace->blocks[index], j = 0; j < size && p[j] == 0; j++)
+		    ;
+		if (j < size) {
+		    malloc_error(tracenum, i, "mm_calloc returned a block that is not zero.");
+		    return 0;
+		}
+	    }
 	    
-	    /* ADDED: cgw
-	     * fill range with low byte of index.  This will be used later
-	     * if we realloc the block and wish to make sure that the old
-	     * data was copied to the new block
-	     */
-	    memset(p, index & 0xFF, size);
-
-	    /* Remember region */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
+	    for (j = 0; j < n; j++, i++, index++) {
+		p = trace->blocks[index];
+		if ((usable = mm_usable_size(p)) < (size_t)size) {
+		    malloc_error(tracenum, i, "mm_usable_size is less than was allocated.");
+		    return 0;
+		}
+
+		/* 
+		 * Test the range of the new block for correctness and add it 
+		 * to the range tree if OK. The block must be  be aligned properly,
+		 * and must not overlap any currently allocated block, up
+		 * to all the bytes it can hold.
+		 */ 
+		if (add_range(ranges, p, usable, tracenum, i) == 0)
+		    return 0;
+	    
+		/* ADDED: cgw
+		 * fill range with low byte of index.  This will be used later
+		 * if we realloc the block and wish to make sure that the old
+		 * data was copied to the new block
+		 */
+		memset(p, index & 0xFF, usable);
+		trace->block_sizes[index] = size;
+	    }
+	    i--;
 	    break;
 
         case REALLOC: /* mm_realloc */
@@ -638,11 +1569,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    /* Check new block for correctness and add it to range tree */
+	    if ((usable = mm_usable_size(newp)) < (size_t)size) {
+		malloc_error(tracenum, i, "mm_usable_size is less than was reallocated.");
+		return 0;
+	    }
+	    if (add_range(ranges, newp, usable, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -653,25 +1588,32 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
 	      }
 	    }
-	    memset(newp, index & 0xFF, size);
+	    memset(newp, index & 0xFF, usable);
 
 	    /* Remember region */
 	    trace->blocks[index] = newp;
 	    trace->block_sizes[index] = size;
 	    break;
 
-        case FREE: /* mm_free */
+        case FREE: /* mm_free, or mm_free_batch for a batch */
 	    
-	    /* Remove region from list and call student's free function */
-	    p = trace->blocks[index];
-	    remove_range(ranges, p);
-	    mm_free(p);
+	    /* Remove regions from list and call student's free function */
+	    n = batch_length(trace, i);
+	    for (j = 0; j < n; j++)
+		remove_range(ranges, trace->blocks[index + j]);
+	    if (n > 1)
+		mm_free_batch((void **)&trace->blocks[index], n);
+	    else if (sized)
+		mm_free_sized(trace->blocks[index], trace->block_sizes[index]);
+	    else
+		mm_free(trace->blocks[index]);
+	    i += n - 1;
 	    break;
 
 	default:
@@ -689,15 +1631,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   largest size of the heap in bytes while running the student's malloc 
+ *   package on the trace. Our implementation of mem_sbrk() lets the
+ *   students decrement the brk pointer, so the final brk is not
+ *   necessarily the high water mark of the heap. 
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {   
-    int i;
+    int i, j, n;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -713,20 +1655,27 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_alloc */
+        case ALLOC: /* mm_alloc, or mm_malloc_batch for a batch */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((n = batch_length(trace, i)) > 1) {
+		if (mm_malloc_batch(size, (void **)&trace->blocks[index], n) != (size_t)n)
+		    app_error("mm_malloc_batch failed in eval_mm_util");
+	    }
+	    else if ((p = alloc_block(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
+	    else
+		trace->blocks[index] = p;
 	    
-	    /* Remember region and size */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
+	    /* Remember sizes */
+	    for (j = 0; j < n; j++)
+		trace->block_sizes[index + j] = size;
+	    i += n - 1;
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
-	    total_size += size;
+	    total_size += n * size;
 	    
 	    /* Update statistics */
 	    max_total_size = (total_size > max_total_size) ?
@@ -755,17 +1704,19 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 		total_size : max_total_size;
 	    break;
 
-        case FREE: /* mm_free */
+        case FREE: /* mm_free, or mm_free_batch for a batch */
 	    index = trace->ops[i].index;
-	    size = trace->block_sizes[index];
-	    p = trace->blocks[index];
-	    
-	    mm_free(p);
-	    
-	    /* Keep track of current total size
-	     * of all allocated blocks */
-	    total_size -= size;
+	    n = batch_length(trace, i);
+	    for (j = 0; j < n; j++)
+		total_size -= trace->block_sizes[index + j];
 	    
+	    if (n > 1)
+		mm_free_batch((void **)&trace->blocks[index], n);
+	    else if (sized)
+		mm_free_sized(trace->blocks[index], trace->block_sizes[index]);
+	    else
+		mm_free(trace->blocks[index]);
+	    i += n - 1;
 	    break;
 
 	default:
@@ -774,7 +1725,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
@@ -784,7 +1735,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, n, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -797,12 +1748,23 @@ static void eval_mm_speed(void *ptr)
     for (i = 0;  i < trace->num_ops;  i++)
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_malloc */
+        case ALLOC: /* mm_malloc, or mm_malloc_batch for a batch */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+	    if (trace->ops[i].batch) {
+		n = batch_length(trace, i);
+		if (mm_malloc_batch(size, (void **)&trace->blocks[index], n) != (size_t)n)
+		    app_error("mm_malloc_batch error in eval_mm_speed");
+		i += n - 1;
+		for (; sized && n > 0; n--)
+		    trace->block_sizes[index + n - 1] = size;
+		break;
+	    }
+            if ((p = alloc_block(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+	    if (sized)
+		trace->block_sizes[index] = size;
             break;
 
 	case REALLOC: /* mm_realloc */
@@ -812,12 +1774,23 @@ static void eval_mm_speed(void *ptr)
             if ((newp = mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+	    if (sized)
+		trace->block_sizes[index] = newsize;
             break;
 
-        case FREE: /* mm_free */
+        case FREE: /* mm_free, or mm_free_batch for a batch */
             index = trace->ops[i].index;
+	    if (trace->ops[i].batch) {
+		n = batch_length(trace, i);
+		mm_free_batch((void **)&trace->blocks[index], n);
+		i += n - 1;
+		break;
+	    }
             block = trace->blocks[index];
-            mm_free(block);
+	    if (sized)
+		mm_free_sized(block, trace->block_sizes[index]);
+	    else
+		mm_free(block);
             break;
 
 	default:
@@ -825,6 +1798,647 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_jobs - Replays a trace on num_jobs threads at once against
+ *    the mm malloc package, which must be thread-safe. Returns the
+ *    best wall clock time of JOBRUNS runs, from when every thread is
+ *    ready until the last one finishes, or 0 if the threads did not
+ *    fit in the heap together. The number of requests made
+ *    over all threads goes in *ops, and the fastest and slowest
+ *    thread's mean latency in ns per request in *min_lat and *max_lat.
+ */
+static double eval_mm_jobs(trace_t *trace, int num_jobs, jobmode_t mode,
+			   int handoff, double *ops, double *min_lat,
+			   double *max_lat)
+{
+    int i, run;
+    double best = DBL_MAX;
+    pthread_t threads[MAXJOBS];
+    job_t jobs[MAXJOBS];
+    jobqueue_t queues[MAXJOBS];
+    pthread_barrier_t barrier;
+
+    pthread_barrier_init(&barrier, NULL, num_jobs);
+    for (i = 0; i < num_jobs; i++) {
+	jobs[i].trace = trace;
+	jobs[i].id = i;
+	jobs[i].num_jobs = num_jobs;
+	jobs[i].mode = mode;
+	jobs[i].barrier = &barrier;
+	jobs[i].queues = handoff ? queues : NULL;
+	if ((jobs[i].blocks = calloc(trace->num_ids, sizeof(char *))) == NULL)
+	    unix_error("blocks calloc in eval_mm_jobs failed");
+	if (handoff && (queues[i].blocks = calloc(trace->num_ops,
+						  sizeof(char *))) == NULL)
+	    unix_error("queue calloc in eval_mm_jobs failed");
+    }
+
+    for (run = 0; run < JOBRUNS; run++) {
+	double secs, run_ops = 0, run_min = DBL_MAX, run_max = 0;
+	struct timespec start, end;
+
+	/* Reset the heap and initialize the mm package */
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_jobs");
+
+	for (i = 0; i < num_jobs; i++) {
+	    if (handoff)
+		queues[i].head = queues[i].tail = 0;
+	    if (pthread_create(&threads[i], NULL, eval_mm_job, &jobs[i]) != 0)
+		unix_error("pthread_create in eval_mm_jobs failed");
+	}
+	for (i = 0; i < num_jobs; i++)
+	    pthread_join(threads[i], NULL);
+
+	for (i = 0; i < num_jobs; i++)
+	    if (jobs[i].failed) {
+		if (verbose > 1)
+		    printf("  thread %d ran out of heap\n", i);
+		best = 0;
+		goto done;
+	    }
+
+	start = jobs[0].start;
+	end = jobs[0].end;
+	for (i = 0; i < num_jobs; i++) {
+	    double lat = ((jobs[i].end.tv_sec - jobs[i].start.tv_sec) * 1e9
+			  + (jobs[i].end.tv_nsec - jobs[i].start.tv_nsec))
+		/ jobs[i].ops;
+	    if (lat < run_min)
+		run_min = lat;
+	    if (lat > run_max)
+		run_max = lat;
+	    if (verbose > 1)
+		printf("  thread %d: %.0f ops, %.1f ns/op\n",
+		       i, jobs[i].ops, lat);
+	    run_ops += jobs[i].ops;
+
+	    if (jobs[i].start.tv_sec < start.tv_sec ||
+		(jobs[i].start.tv_sec == start.tv_sec &&
+		 jobs[i].start.tv_nsec < start.tv_nsec))
+		start = jobs[i].start;
+	    if (jobs[i].end.tv_sec > end.tv_sec ||
+		(jobs[i].end.tv_sec == end.tv_sec &&
+		 jobs[i].end.tv_nsec > end.tv_nsec))
+		end = jobs[i].end;
+	}
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	if (secs < best) {
+	    best = secs;
+	    *ops = run_ops;
+	    *min_lat = run_min;
+	    *max_lat = run_max;
+	}
+    }
+
+done:
+    for (i = 0; i < num_jobs; i++) {
+	free(jobs[i].blocks);
+	if (handoff)
+	    free(queues[i].blocks);
+    }
+    pthread_barrier_destroy(&barrier);
+    return best;
+}
+
+/*
+ * eval_mm_job - The body of one thread of eval_mm_jobs. With handed
+ *    off frees, each thread frees the blocks of the thread before it,
+ *    and waits for all of them to stop allocating before freeing the
+ *    last of them. A thread that runs out of heap stops early, since
+ *    replicas of a trace need not fit in the heap together.
+ */
+static void *eval_mm_job(void *ptr)
+{
+    job_t *job = ptr;
+    trace_t *trace = job->trace;
+    int i, index;
+    char *p;
+
+    job->ops = 0;
+    job->failed = 0;
+    pthread_barrier_wait(job->barrier);
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+
+    for (i = 0;  i < trace->num_ops && !job->failed;  i++) {
+	index = trace->ops[i].index;
+	if (job->mode == JOB_PARTITION && index % job->num_jobs != job->id)
+	    continue;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(trace->ops[i].size)) == NULL) {
+		job->failed = 1;
+		break;
+	    }
+            job->blocks[index] = p;
+	    job->ops++;
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(job->blocks[index], trace->ops[i].size)) == NULL) {
+		job->failed = 1;
+		break;
+	    }
+            job->blocks[index] = p;
+	    job->ops++;
+            break;
+
+        case FREE: /* mm_free, maybe by the next thread */
+	    if (job->queues != NULL) {
+		jobqueue_t *q = &job->queues[(job->id + 1) % job->num_jobs];
+		q->blocks[q->tail] = job->blocks[index];
+		__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+	    } else {
+		mm_free(job->blocks[index]);
+		job->ops++;
+	    }
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_job");
+        }
+
+	if (job->queues != NULL)
+	    free_handoffs(job);
+    }
+
+    if (job->queues != NULL) {
+	pthread_barrier_wait(job->barrier);
+	free_handoffs(job);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &job->end);
+    return NULL;
+}
+
+/*
+ * free_handoffs - Frees the blocks handed off to a thread so far
+ */
+static void free_handoffs(job_t *job)
+{
+    jobqueue_t *q = &job->queues[job->id];
+    int tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+    for (; q->head < tail; q->head++) {
+	mm_free(q->blocks[q->head]);
+	job->ops++;
+    }
+}
+
+/*
+ * eval_mm_latency - Replays a trace once, timing every request with
+ *    the cycle counter into a histogram of its type. The overhead of
+ *    reading the counter, at its least, is subtracted from each request.
+ */
+static void eval_mm_latency(trace_t *trace, hist_t hists[NUM_OPTYPES])
+{
+    int i, index, size, type;
+    char *p;
+    double cycles, overhead = DBL_MAX;
+
+    for (type = 0; type < NUM_OPTYPES; type++)
+	hist_init(&hists[type]);
+
+    for (i = 0; i < 100; i++)
+	if ((cycles = ovhd()) < overhead)
+	    overhead = cycles;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	type = trace->ops[i].type;
+
+        switch (type) {
+
+        case ALLOC: /* mm_malloc */
+	    start_counter();
+	    p = mm_malloc(size);
+	    cycles = get_counter();
+            if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    start_counter();
+	    p = mm_realloc(trace->blocks[index], size);
+	    cycles = get_counter();
+            if (p == NULL)
+		app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free */
+	    p = trace->blocks[index];
+	    start_counter();
+	    mm_free(p);
+	    cycles = get_counter();
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+        }
+
+	hist_add(&hists[type], cycles - overhead);
+    }
+}
+
+/*
+ * eval_mm_realloc - replays a trace, timing only the reallocs, and
+ *    counts how many of them moved their block and how many bytes
+ *    those moves had to preserve. A move from one mapping to another
+ *    is counted apart, since the pages can be remapped instead.
+ */
+static void eval_mm_realloc(trace_t *trace, reallocstats_t *rs)
+{
+    int i, index, size, oldsize, mapped;
+    char *p, *oldp;
+    struct timespec start, end;
+
+    memset(rs, 0, sizeof(*rs));
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_realloc");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc error in eval_mm_realloc");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    oldp = trace->blocks[index];
+	    oldsize = trace->block_sizes[index];
+	    mapped = mem_is_mapped(oldp, oldp);
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    p = mm_realloc(oldp, size);
+	    clock_gettime(CLOCK_MONOTONIC, &end);
+            if (p == NULL)
+		app_error("mm_realloc error in eval_mm_realloc");
+
+	    rs->ops++;
+	    rs->secs += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	    if (p != oldp) {
+		rs->moved++;
+		if (mapped && mem_is_mapped(p, p))
+		    rs->remapped++;
+		else
+		    rs->copied += oldsize < size ? oldsize : size;
+	    }
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case FREE: /* mm_free */
+	    mm_free(trace->blocks[index]);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_realloc");
+        }
+    }
+}
+
+/*
+ * eval_mm_timeline - Replays a trace against the mm malloc package,
+ *    walking its heap after every tl->every requests and at the end
+ *    to write a sample of the timeline. If mm.c can't walk its heap,
+ *    says so and sets tl->num_classes to -2.
+ */
+static void eval_mm_timeline(trace_t *trace, int tracenum, timeline_t *tl)
+{
+    int i, index, size;
+    char *p;
+    double live = 0;  /* payload bytes the trace has asked for */
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_timeline");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc error in eval_mm_timeline");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+	    live += size;
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc error in eval_mm_timeline");
+	    live += size - (double)trace->block_sizes[index];
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case FREE: /* mm_free */
+	    mm_free(trace->blocks[index]);
+	    live -= trace->block_sizes[index];
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_timeline");
+        }
+
+	if ((i + 1) % tl->every == 0 || i + 1 == trace->num_ops) {
+	    write_sample(tl, tracenum, i + 1, live);
+	    if (tl->num_classes == -2) {
+		printf("mm.c can't walk its heap, so -T has no timeline\n");
+		return;
+	    }
+	}
+    }
+}
+
+/*
+ * sample_block - adds a block of the walk of the heap to a sample
+ */
+static void sample_block(const mm_block_t *block, void *arg)
+{
+    sample_t *s = arg;
+    int c = block->class_index;
+
+    if (block->alloc) {
+	s->alloc += block->bytes;
+	return;
+    }
+    s->free += block->bytes;
+    if (block->bytes > s->largest)
+	s->largest = block->bytes;
+    if (c < 0 || c >= s->num_classes)
+	c = s->num_classes;
+    s->class_free[c] += block->bytes;
+}
+
+/*
+ * write_sample - walks the heap and writes what it found to the timeline,
+ *    along with the number of the request just made and the payload
+ *    bytes live. The first sample of a CSV timeline writes its heading.
+ *    External fragmentation is how much of the free bytes are not in
+ *    the largest free block.
+ */
+static void write_sample(timeline_t *tl, int tracenum, int opnum, double live)
+{
+    sample_t s;
+    int c, n;
+    double frag;
+
+    memset(&s, 0, sizeof(s));
+    s.num_classes = (tl->num_classes < 0) ? MM_STATS_CLASSES : tl->num_classes;
+    n = mm_heap_walk(sample_block, &s);
+    if (tl->num_classes < 0) {
+	if (n < 0 || n > MM_STATS_CLASSES) {
+	    tl->num_classes = -2;
+	    return;
+	}
+	/* Blocks of classes past the number mm.c has are in none */
+	for (c = n; c < MM_STATS_CLASSES; c++) {
+	    s.class_free[MM_STATS_CLASSES] += s.class_free[c];
+	    s.class_free[c] = 0;
+	}
+	s.class_free[n] = s.class_free[MM_STATS_CLASSES];
+	tl->num_classes = n;
+    }
+    n = tl->num_classes;
+    frag = (s.free > 0) ? 1 - s.largest/s.free : 0;
+
+    if (tl->json) {
+	fprintf(tl->file, "%s\n{\"trace\": %d, \"op\": %d, \"heap\": %lu, "
+		"\"live\": %.0f, \"alloc\": %.0f, \"free\": %.0f, "
+		"\"largest_free\": %.0f, \"ext_frag\": %.4f, \"free_by_class\": [",
+		tl->samples ? "," : "", tracenum, opnum,
+		(unsigned long)mem_heapsize(), live, s.alloc, s.free,
+		s.largest, frag);
+	for (c = 0; c < n; c++)
+	    fprintf(tl->file, "%s%.0f", c ? ", " : "", s.class_free[c]);
+	fprintf(tl->file, "], \"free_other\": %.0f}", s.class_free[n]);
+    }
+    else {
+	if (tl->samples == 0) {
+	    fprintf(tl->file, "trace,op,heap,live,alloc,free,largest_free,ext_frag");
+	    for (c = 0; c < n; c++)
+		fprintf(tl->file, ",free_%d", c);
+	    fprintf(tl->file, ",free_other\n");
+	}
+	fprintf(tl->file, "%d,%d,%lu,%.0f,%.0f,%.0f,%.0f,%.4f",
+		tracenum, opnum, (unsigned long)mem_heapsize(), live,
+		s.alloc, s.free, s.largest, frag);
+	for (c = 0; c <= n; c++)
+	    fprintf(tl->file, ",%.0f", s.class_free[c]);
+	fprintf(tl->file, "\n");
+    }
+    tl->samples++;
+}
+
+/*
+ * pin_cpu - Keep mdriver on the CPU it is running on, so that the
+ *    benchmark runs don't migrate between caches
+ */
+static void pin_cpu(void)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    int cpu = sched_getcpu();
+
+    CPU_ZERO(&set);
+    if (cpu >= 0)
+	CPU_SET(cpu, &set);
+    if (cpu < 0 || sched_setaffinity(0, sizeof(set), &set) < 0)
+	printf("Could not pin mdriver to a CPU: %s\n", strerror(errno));
+    else if (verbose)
+	printf("Pinned mdriver to CPU %d.\n", cpu);
+#endif
+}
+
+/*
+ * eval_mm_bench - Time runs of a trace against the mm malloc package
+ *    one by one after BENCHWARMUPS untimed runs, and summarize them by
+ *    their median. The confidence interval of the median is between
+ *    the order statistics that a binomial(runs, 1/2) puts it between
+ *    95% of the time, which holds whatever the distribution of the
+ *    run times, however skewed by interrupts and preemption.
+ */
+static void eval_mm_bench(speed_t *params, int runs, benchstats_t *bs)
+{
+    double *secs;
+    struct timespec start, end;
+    int i, lo, hi;
+
+    if ((secs = malloc(runs * sizeof(double))) == NULL)
+	unix_error("malloc failed in eval_mm_bench");
+    for (i = 0; i < BENCHWARMUPS; i++)
+	eval_mm_speed(params);
+    for (i = 0; i < runs; i++) {
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	eval_mm_speed(params);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs[i] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    qsort(secs, runs, sizeof(double), cmp_double);
+
+    bs->runs = runs;
+    bs->median = (runs % 2) ? secs[runs / 2]
+	: (secs[runs / 2 - 1] + secs[runs / 2]) / 2;
+    /* The ranks, from 1, by the normal approximation to the binomial */
+    lo = (int)floor((runs - 1.96 * sqrt(runs)) / 2);
+    hi = (int)ceil(1 + (runs + 1.96 * sqrt(runs)) / 2);
+    bs->lo = secs[(lo < 1) ? 0 : lo - 1];
+    bs->hi = secs[(hi > runs) ? runs - 1 : hi - 1];
+    free(secs);
+}
+
+/*
+ * cmp_double - Order doubles for qsort
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * read_baseline - Read a file that write_bench wrote into a new array,
+ *    returning the number of traces in it
+ */
+static int read_baseline(char *path, baseline_t **base)
+{
+    FILE *file;
+    char line[MAXLINE];
+    baseline_t b;
+    int n = 0;
+
+    if ((file = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in read_baseline", path);
+	unix_error(msg);
+    }
+    *base = NULL;
+    while (fgets(line, MAXLINE, file) != NULL) {
+	if (line[0] == '#')
+	    continue;
+	if (sscanf(line, "%s %d %lf %lf %lf %lf", b.name, &b.bench.runs,
+		   &b.bench.median, &b.bench.lo, &b.bench.hi, &b.util) != 6) {
+	    printf("Bogus line in benchmark results %s: %s", path, line);
+	    exit(1);
+	}
+	if ((*base = realloc(*base, (n + 1) * sizeof(baseline_t))) == NULL)
+	    unix_error("realloc failed in read_baseline");
+	(*base)[n++] = b;
+    }
+    fclose(file);
+    return n;
+}
+
+/*
+ * write_bench - Write the benchmark results of the traces that ran,
+ *    a line each, for a later -r to compare against
+ */
+static void write_bench(char *path, int n, char **names, stats_t *stats,
+			benchstats_t *bstats)
+{
+    FILE *file;
+    int i;
+
+    if ((file = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in write_bench", path);
+	unix_error(msg);
+    }
+    fprintf(file, "# trace runs median_secs lo_secs hi_secs util\n");
+    for (i = 0; i < n; i++)
+	if (bstats[i].runs)
+	    fprintf(file, "%s %d %.9f %.9f %.9f %.6f\n", names[i],
+		    bstats[i].runs, bstats[i].median, bstats[i].lo,
+		    bstats[i].hi, stats[i].util);
+    if (fclose(file) != 0) {
+	sprintf(msg, "Could not write %s in write_bench", path);
+	unix_error(msg);
+    }
+}
+
+/*
+ * printbenchresults - prints the median throughput of each trace with
+ *    its confidence interval, and with basefile, the change from the
+ *    results there. A trace regressed if its median is more than
+ *    threshold percent slower, or its utilization that much lower, and
+ *    the slowdown is more than noise: the confidence intervals don't
+ *    overlap. Returns the number of traces that regressed.
+ */
+static int printbenchresults(int n, char **names, stats_t *stats,
+			     benchstats_t *bstats, char *basefile,
+			     double threshold)
+{
+    baseline_t *base = NULL;
+    benchstats_t *bs, *old;
+    int num_base = 0, regressions = 0;
+    int i, j, slower, leaner;
+    double change;
+
+    if (basefile != NULL)
+	num_base = read_baseline(basefile, &base);
+
+    printf("%5s%6s%8s%17s", "trace", "runs", "Kops", "95% CI Kops");
+    if (basefile != NULL)
+	printf("%8s%8s%8s  %s", "base", "change", "util", "verdict");
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	bs = &bstats[i];
+	if (!bs->runs) {
+	    printf("%2d%9s%8s%17s\n", i, "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%9d%8.0f%8.0f -%7.0f", i, bs->runs,
+	       stats[i].ops / 1e3 / bs->median,
+	       stats[i].ops / 1e3 / bs->hi, stats[i].ops / 1e3 / bs->lo);
+	if (basefile == NULL) {
+	    printf("\n");
+	    continue;
+	}
+
+	for (j = 0; j < num_base && strcmp(base[j].name, names[i]); j++)
+	    ;
+	if (j == num_base) {
+	    printf("%8s%8s%8s  %s\n", "-", "-", "-", "new");
+	    continue;
+	}
+	old = &base[j].bench;
+	change = (old->median / bs->median - 1) * 100; /* in throughput */
+	slower = change < -threshold && bs->lo > old->hi;
+	leaner = stats[i].util < base[j].util * (1 - threshold / 100);
+	printf("%8.0f%+7.1f%%%+7.1f%%  %s\n", stats[i].ops / 1e3 / old->median,
+	       change, (stats[i].util - base[j].util) * 100,
+	       slower ? "SLOWER" : leaner ? "LESS UTIL" :
+	       (change > threshold && bs->hi < old->lo) ? "faster" : "ok");
+	regressions += slower || leaner;
+    }
+    free(base);
+    return regressions;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -918,19 +2532,24 @@ static void eval_libc_speed(void *ptr)
 /*
  * printresults - prints a performance summary for some malloc package
  */
-static void printresults(int n, stats_t *stats) 
+static void printresults(int n, stats_t *stats, int perf) 
 {
-    int i;
+    int i, e;
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double events[FPERF_EVENTS] = {0};
+    double event_ops[FPERF_EVENTS] = {0}; /* ops of the traces counted */
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
+    printf("%5s%7s %5s%8s%10s%6s", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
+    for (e = 0; perf && e < FPERF_EVENTS; e++)
+	printf("%8s", fperf_names[e]);
+    printf("\n");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
@@ -940,36 +2559,184 @@ static void printresults(int n, stats_t *stats)
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+
+	    /* The events are per request */
+	    for (e = 0; perf && e < FPERF_EVENTS; e++) {
+		if (stats[i].events[e] < 0) {
+		    printf("%8s", "-");
+		    continue;
+		}
+		printf("%8.2f", stats[i].events[e]/stats[i].ops);
+		events[e] += stats[i].events[e];
+		event_ops[e] += stats[i].ops;
+	    }
+	    printf("\n");
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
+	    printf("%2d%10s%6s%8s%10s%6s", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
 		   "-");
+	    for (e = 0; perf && e < FPERF_EVENTS; e++)
+		printf("%8s", "-");
+	    printf("\n");
 	}
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%8.0f%10.6f%6.0f", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
+	for (e = 0; perf && e < FPERF_EVENTS; e++) {
+	    if (event_ops[e] > 0)
+		printf("%8.2f", events[e]/event_ops[e]);
+	    else
+		printf("%8s", "-");
+	}
+	printf("\n");
     }
     else {
-	printf("%12s%6s%8s%10s%6s\n", 
+	printf("%12s%6s%8s%10s%6s", 
 	       "Total       ",
 	       "-", 
 	       "-", 
 	       "-", 
 	       "-");
+	for (e = 0; perf && e < FPERF_EVENTS; e++)
+	    printf("%8s", "-");
+	printf("\n");
+    }
+}
+
+/*
+ * printlatresults - prints the latency percentiles of every request type
+ *    for each trace, in cycles
+ */
+static void printlatresults(int n, stats_t *stats,
+			    hist_t (*hists)[NUM_OPTYPES])
+{
+    int i, type;
+
+    printf("%5s%8s%8s%8s%8s%8s%8s%9s\n",
+	   "trace", "op", "count", "p50", "p90", "p99", "p999", "max");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%11s%8s%8s%8s%8s%8s%9s\n",
+		   i, "-", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	for (type = 0; type < NUM_OPTYPES; type++) {
+	    hist_t *h = &hists[i][type];
+	    if (h->total == 0) /* e.g. no reallocs in the trace */
+		continue;
+	    printf("%2d%11s%8lu%8.0f%8.0f%8.0f%8.0f%9.0f\n",
+		   i,
+		   optype_names[type],
+		   h->total,
+		   hist_percentile(h, .50),
+		   hist_percentile(h, .90),
+		   hist_percentile(h, .99),
+		   hist_percentile(h, .999),
+		   h->max);
+	}
+    }
+}
+
+/*
+ * printreallocresults - prints the throughput of the reallocs of each
+ *    trace on their own, and how much they moved
+ */
+static void printreallocresults(int n, stats_t *stats,
+				reallocstats_t *rstats)
+{
+    int i;
+
+    printf("%5s%8s%8s%8s%8s%10s\n",
+	   "trace", "ops", "Kops", "moved", "remap", "KB copied");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid || rstats[i].ops == 0) {
+	    printf("%2d%11s%8s%8s%8s%10s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%11.0f%8.0f%8.0f%8.0f%10.0f\n",
+	       i,
+	       rstats[i].ops,
+	       (rstats[i].ops/1e3)/rstats[i].secs,
+	       rstats[i].moved,
+	       rstats[i].remapped,
+	       rstats[i].copied/1024);
+    }
+}
+
+/*
+ * printcounters - prints what mm_stats counted over one run of a trace
+ */
+static void printcounters(int tracenum)
+{
+    mm_stats_t s;
+    int i;
+
+    if (mm_stats(&s) < 0) {
+	printf("trace %d: mm.c was built without counters\n", tracenum);
+	return;
+    }
+
+    printf("trace %d: %lu fit steps, %lu escalations, %lu splits, "
+	   "%lu coalesces, %lu grows (%lu bytes)\n",
+	   tracenum, s.fit_steps, s.escalations, s.splits, s.coalesces,
+	   s.grows, s.grow_bytes);
+    printf("  realloc: %lu shrink, %lu right, %lu left, %lu grow, %lu move\n",
+	   s.realloc_shrink, s.realloc_right, s.realloc_left,
+	   s.realloc_grow, s.realloc_move);
+    printf("  free blocks by class:");
+    for (i = 0; i < s.num_classes && i < MM_STATS_CLASSES; i++)
+	printf(" %lu", s.free_blocks[i]);
+    printf("\n");
+}
+
+/*
+ * printjobresults - prints how the mm malloc package scales over threads
+ */
+static void printjobresults(int n, int num_jobs, jobstats_t *stats)
+{
+    int i;
+    double ops1 = 0, secs1 = 0, ops = 0, secs = 0;
+
+    printf("%5s%8s%8s%7s%9s%9s\n",
+	   "trace", "Kops1", "Kops", "effic", "minlat", "maxlat");
+    for (i = 0; i < n; i++) {
+	/* not run since the trace was invalid, or did not fit in the heap */
+	if (stats[i].secs1 == 0 || stats[i].secs == 0) {
+	    printf("%2d%11s%8s%7s%9s%9s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%11.0f%8.0f%6.0f%%%9.1f%9.1f\n",
+	       i,
+	       (stats[i].ops1/1e3)/stats[i].secs1,
+	       (stats[i].ops/1e3)/stats[i].secs,
+	       100.0 * (stats[i].ops/stats[i].secs)
+	       / (num_jobs * stats[i].ops1/stats[i].secs1),
+	       stats[i].min_lat,
+	       stats[i].max_lat);
+	ops1 += stats[i].ops1;
+	secs1 += stats[i].secs1;
+	ops += stats[i].ops;
+	secs += stats[i].secs;
     }
 
+    if (secs > 0)
+	printf("%s%8.0f%8.0f%6.0f%%\n",
+	       "Total",
+	       (ops1/1e3)/secs1,
+	       (ops/1e3)/secs,
+	       100.0 * (ops/secs) / (num_jobs * ops1/secs1));
 }
 
 /* 
@@ -1004,14 +2771,43 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValpcHPRSsLz] [-f <file>] [-t <dir>] [-w <spec>] [-j <n>] [-m <mb>] [-A <bytes>] [-B <file>] [-T <file>] [-N <n>]\n"
+	    "\t[-b <runs> [-o <file>] [-r <file>] [-x <pct>]]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <bytes> Allocate with mm_memalign to an alignment of bytes, a power of 2.\n");
+    fprintf(stderr, "\t-b <runs>  Benchmark every trace with runs timed runs, on one CPU.\n");
+    fprintf(stderr, "\t-B <file>  Convert the trace of -f or -w to a binary trace in <file>.\n");
+    fprintf(stderr, "\t           Binary traces are mapped rather than read.\n");
+    fprintf(stderr, "\t-c         With -j, free blocks on another thread.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t           A capture of libmm.so (see shim.c) is converted as it is read.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Print latency percentiles of every request.\n");
+    fprintf(stderr, "\t-j <n>     Also replay each trace on n threads at once.\n");
+    fprintf(stderr, "\t           mm.c must be thread-safe, e.g. mm-arena.c.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Back the heap with huge pages if there are any.\n");
+    fprintf(stderr, "\t-m <mb>    Reserve mb MB for the heap instead of %d.\n", MAX_HEAP >> 20);
+    fprintf(stderr, "\t-N <n>     With -T, sample the heap every n requests (default 1000).\n");
+    fprintf(stderr, "\t-o <file>  With -b, write the results to <file>.\n");
+    fprintf(stderr, "\t-p         With -j, split each trace between the threads.\n");
+    fprintf(stderr, "\t-P         Print hardware events per request, from perf_event_open.\n");
+    fprintf(stderr, "\t-r <file>  With -b, compare to the results in <file> and fail\n");
+    fprintf(stderr, "\t           if a trace regressed.\n");
+    fprintf(stderr, "\t-R         Print the throughput and copy volume of the reallocs.\n");
+    fprintf(stderr, "\t-S         Free with mm_free_sized, passing the size of every block.\n");
+    fprintf(stderr, "\t-s         Print the counters of mm.c after each trace.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <file>  Write a timeline of the fragmentation of the heap to <file>,\n");
+    fprintf(stderr, "\t           as JSON if it ends in .json, as CSV otherwise.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-x <pct>   With -r, the regression to fail on in percent (default 5).\n");
+    fprintf(stderr, "\t-w <spec>  Generate a trace from spec instead of reading one,\n");
+    fprintf(stderr, "\t           once for every -w, e.g. -w ops=10m,live=100k.\n");
+    fprintf(stderr, "\t           The spec is key=value,... of\n");
+    fprintf(stderr, WL_USAGE);
+    fprintf(stderr, "\t-z         Allocate with mm_calloc, checking that the blocks are zero.\n");
 }
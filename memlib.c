@@ -2,7 +2,23 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * The heap is a range of virtual memory reserved up front, whose pages
+ * are only made accessible as the brk pointer first reaches them.
+ * Mappings made apart from the heap count towards its peak size, like
+ * the mmap'd chunks of a real allocator do towards its footprint.
+ *
+ * Like fresh memory from the kernel, the part of an arena that has never
+ * been in use reads as zero, so that calloc can skip clearing it.
+ * Resetting the brk pointer leaves the heap as it is, but the arenas it
+ * gives back are released, since the heap may grow into them later.
+ *
+ * The slots of the arenas are the largest power of 2 that leaves the
+ * heap itself at least half of the range, however many are carved, so
+ * that a larger heap gives every arena more room. A carved arena that
+ * runs out doesn't complain, as its caller can fall back on the heap.
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,6 +26,7 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
@@ -18,20 +35,94 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_top;        /* end of the storage; arenas are carved below it */
+static int mem_arenas;       /* arenas in use, counting the heap itself as arena 0 */
+static char *arena_brk[MAX_ARENAS]; /* brk pointer of each carved arena */
+static size_t arena_bytes;   /* size of the slot of an arena, a power of 2 */
+static int arena_shift;      /* log2(arena_bytes) */
+static size_t mem_total;     /* mem_heapsize() and the mappings, kept up to date for the peak */
+static size_t mem_peak;      /* largest heap size since the last reset */
+static size_t mem_max_heap = MAX_HEAP; /* bytes of the range mem_init reserves */
+static int mem_huge;         /* whether to ask for huge pages */
+static size_t mem_commit_unit; /* granularity of committing, a page or a huge page */
+static char *arena_committed[MAX_ARENAS]; /* end of the accessible part of each arena */
+static char *arena_fresh[MAX_ARENAS]; /* end of the part of each arena ever in use */
+
+/* mappings made with mem_map, for mem_is_mapped to check ranges against */
+typedef struct {
+    char *lo;
+    size_t bytes;
+} mapping_t;
+static mapping_t *maps;      /* grown with realloc as needed */
+static int num_maps, max_maps;
+static pthread_mutex_t maps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *arena_lo(int arena);
+static int commit(int arena, char *brk);
+static void add_fresh(int arena, char *brk);
+static void add_total(size_t incr);
+static int find_map(const char *lo);
+
+/*
+ * mem_configure - set the size of the range the next mem_init reserves
+ *    for the heap, and whether it tries to back it with huge pages
+ */
+void mem_configure(size_t max_heap, int huge)
+{
+    mem_max_heap = max_heap;
+    mem_huge = huge;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    int arena;
+
+    /* reserve the address space we will use to model the available VM */
+    mem_start_brk = MAP_FAILED;
+    mem_commit_unit = mem_pagesize();
+#ifdef MAP_HUGETLB
+    if (mem_huge) {
+	/* huge pages have to be committed and released whole */
+	mem_max_heap = (mem_max_heap + HUGE_PAGE_BYTES - 1) & ~(size_t)(HUGE_PAGE_BYTES - 1);
+	mem_start_brk = mmap(NULL, mem_max_heap, PROT_NONE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_HUGETLB, -1, 0);
+	if (mem_start_brk != MAP_FAILED)
+	    mem_commit_unit = HUGE_PAGE_BYTES;
+    }
+#endif
+    if (mem_start_brk == MAP_FAILED)
+	mem_start_brk = mmap(NULL, mem_max_heap, PROT_NONE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
+#ifdef MADV_HUGEPAGE
+    /* without reserved huge pages, let the kernel use transparent ones */
+    if (mem_huge && mem_commit_unit != HUGE_PAGE_BYTES)
+	madvise(mem_start_brk, mem_max_heap, MADV_HUGEPAGE);
+#endif
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    /* the largest slots that leave the heap itself half of the range */
+    arena_bytes = MIN_ARENA_BYTES;
+    while (arena_bytes * 2 * (MAX_ARENAS - 1) * 2 <= mem_max_heap)
+	arena_bytes *= 2;
+    if (arena_bytes < mem_commit_unit)
+	arena_bytes = mem_commit_unit; /* huge pages are committed whole */
+    arena_shift = __builtin_ctzl(arena_bytes);
+
+    mem_top = mem_start_brk + mem_max_heap;
+    mem_max_addr = mem_top;                   /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_arenas = 1;
+    for (arena = 0; arena < MAX_ARENAS; arena++) {
+	arena_committed[arena] = NULL;
+	arena_fresh[arena] = arena_lo(arena);
+    }
+    arena_committed[0] = mem_start_brk;
 }
 
 /* 
@@ -39,35 +130,390 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_start_brk, mem_max_heap);
+    free(maps);
+    maps = NULL;
+    max_maps = 0;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    giving back every arena carved out of it and every mapping
  */
 void mem_reset_brk()
 {
+    int arena;
+    size_t bytes;
+
+    for (arena = 1; arena < MAX_ARENAS; arena++) {
+	bytes = arena_fresh[arena] - arena_lo(arena);
+	if (bytes > 0) {
+	    bytes = (bytes + mem_commit_unit - 1) & ~(mem_commit_unit - 1);
+	    madvise(arena_lo(arena), bytes, MADV_DONTNEED);
+	    arena_fresh[arena] = arena_lo(arena);
+	}
+    }
+
+    pthread_mutex_lock(&maps_lock);
+    while (num_maps > 0) {
+	num_maps--;
+	munmap(maps[num_maps].lo, maps[num_maps].bytes);
+    }
+    pthread_mutex_unlock(&maps_lock);
+
     mem_brk = mem_start_brk;
+    mem_max_addr = mem_top;
+    mem_arenas = 1;
+    mem_total = mem_peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area,
+ *    or with a negative incr, shrinks the heap and returns the old brk.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_arena_sbrk(0, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
+/*
+ * arena_lo - return address of the first byte of an arena
+ */
+static char *arena_lo(int arena)
+{
+    return arena == 0 ? mem_start_brk : mem_top - arena * arena_bytes;
+}
+
+/*
+ * commit - make the pages of an arena accessible up to brk, if they
+ *    are not yet. Two threads may both commit the same pages, which is
+ *    harmless. Returns 0 on success, -1 if the pages cannot be had.
+ */
+static int commit(int arena, char *brk)
+{
+    char *committed = __atomic_load_n(&arena_committed[arena], __ATOMIC_RELAXED);
+    char *end;
+
+    if (brk <= committed)
+	return 0;
+    end = (char *)(((size_t)brk + mem_commit_unit - 1) & ~(mem_commit_unit - 1));
+    if (mprotect(committed, end - committed, PROT_READ | PROT_WRITE) < 0)
+	return -1;
+
+    while (end > committed
+	   && !__atomic_compare_exchange_n(&arena_committed[arena], &committed, end, 0,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+    return 0;
+}
+
+/*
+ * mem_arena_new - carve a new arena of arena_bytes out of the top of
+ *    the heap, lowering the heap's limit. Returns the arena's index, or
+ *    -1 if there are already MAX_ARENAS or the heap has grown past where
+ *    the arena would go. Must not be called concurrently with mem_sbrk.
+ */
+int mem_arena_new(void)
+{
+    char *lo;
+
+    if (mem_arenas == MAX_ARENAS)
+	return -1;
+    if ((size_t)(mem_top - mem_brk) < (size_t)mem_arenas * arena_bytes)
+	return -1;
+    lo = arena_lo(mem_arenas);
+
+    __atomic_store_n(&mem_max_addr, lo, __ATOMIC_RELAXED);
+    arena_brk[mem_arenas] = lo;
+    /* the heap may have been in the arena's place before a reset */
+    if (arena_fresh[0] > lo)
+	add_fresh(mem_arenas, arena_fresh[0] < lo + arena_bytes ? arena_fresh[0] : lo + arena_bytes);
+    /* the pages stay committed from an earlier carving of the same arena */
+    if (arena_committed[mem_arenas] == NULL)
+	arena_committed[mem_arenas] = lo;
+    return mem_arenas++;
+}
+
+/*
+ * mem_arena_sbrk - mem_sbrk on one arena, with the heap itself as arena 0.
+ *    The brk pointer is bumped with a compare-and-swap, so threads can
+ *    grow an arena concurrently. The pages given up by shrinking are
+ *    released.
+ */
+void *mem_arena_sbrk(int arena, int incr)
+{
+    char **brk = arena == 0 ? &mem_brk : &arena_brk[arena];
+    char *max_addr = arena == 0 ? mem_max_addr : arena_lo(arena) + arena_bytes;
+    char *old_brk;
+
+    assert(arena >= 0 && arena < MAX_ARENAS);
+    do {
+	old_brk = *brk;
+	if (incr < 0 && (size_t)-incr > (size_t)(old_brk - arena_lo(arena))) {
+	    errno = EINVAL;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap...\n");
+	    return (void *)-1;
+	}
+	if ((old_brk + incr) > max_addr || commit(arena, old_brk + incr) < 0) {
+	    errno = ENOMEM;
+	    if (arena == 0)
+		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	    return (void *)-1;
+	}
+    } while (!__sync_bool_compare_and_swap(brk, old_brk, old_brk + incr));
+
+    add_total((size_t)incr);
+    if (incr < 0)
+	mem_release(old_brk + incr, -incr);
+    else
+	add_fresh(arena, old_brk + incr);
     return (void *)old_brk;
 }
 
+/*
+ * add_fresh - raise the end of the part of an arena ever in use to brk,
+ *    if it is not that high yet
+ */
+static void add_fresh(int arena, char *brk)
+{
+    char *fresh = __atomic_load_n(&arena_fresh[arena], __ATOMIC_RELAXED);
+
+    while (brk > fresh
+	   && !__atomic_compare_exchange_n(&arena_fresh[arena], &fresh, brk, 0,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+/*
+ * mem_arena_fresh - return the end of the part of an arena that has
+ *    ever been in use. Every byte past it, up to where the arena can
+ *    grow, reads as zero until the brk pointer passes it.
+ */
+void *mem_arena_fresh(int arena)
+{
+    assert(arena >= 0 && arena < MAX_ARENAS);
+    return (void *)__atomic_load_n(&arena_fresh[arena], __ATOMIC_RELAXED);
+}
+
+/*
+ * add_total - add to the running total of the heap and the mappings,
+ *    raising the peak if it grows past it. A negative incr is passed
+ *    as its two's complement.
+ */
+static void add_total(size_t incr)
+{
+    size_t size = __atomic_add_fetch(&mem_total, incr, __ATOMIC_RELAXED);
+    size_t peak;
+
+    if ((ssize_t)incr < 0)
+	return;
+    peak = __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+    while (size > peak
+	   && !__atomic_compare_exchange_n(&mem_peak, &peak, size, 0,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+/*
+ * mem_release - give the pages wholly inside a range of the heap back
+ *    to the system, like a real allocator would with madvise. The range
+ *    stays part of the heap, but its pages read as zero afterwards.
+ */
+void mem_release(void *lo, size_t bytes)
+{
+    size_t start = ((size_t)lo + mem_commit_unit - 1) & ~(mem_commit_unit - 1);
+    size_t end = ((size_t)lo + bytes) & ~(mem_commit_unit - 1);
+
+    if (start < end)
+	madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
+/*
+ * mem_map - map bytes of memory apart from the heap, rounded up to
+ *    whole pages, like mmap, all of which read as zero. Returns the
+ *    start of the mapping, or NULL if it cannot be had.
+ */
+void *mem_map(size_t bytes)
+{
+    char *lo;
+
+    bytes = (bytes + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    lo = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lo == MAP_FAILED)
+	return NULL;
+
+    pthread_mutex_lock(&maps_lock);
+    if (num_maps == max_maps) {
+	int new_max = max_maps ? 2 * max_maps : 16;
+	mapping_t *new_maps = realloc(maps, new_max * sizeof(*maps));
+	if (new_maps == NULL) {
+	    pthread_mutex_unlock(&maps_lock);
+	    munmap(lo, bytes);
+	    return NULL;
+	}
+	maps = new_maps;
+	max_maps = new_max;
+    }
+    maps[num_maps].lo = lo;
+    maps[num_maps].bytes = bytes;
+    num_maps++;
+    pthread_mutex_unlock(&maps_lock);
+
+    add_total(bytes);
+    return lo;
+}
+
+/*
+ * find_map - return the index of the mapping that starts at lo, or -1.
+ *    Must hold maps_lock.
+ */
+static int find_map(const char *lo)
+{
+    int k;
+
+    for (k = num_maps - 1; k >= 0; k--)
+	if (maps[k].lo == lo)
+	    return k;
+    return -1;
+}
+
+/*
+ * mem_unmap - unmap the whole of a mapping made by mem_map.
+ *    Returns 0 on success, -1 if lo does not start a mapping.
+ */
+int mem_unmap(void *lo)
+{
+    size_t bytes;
+    int k;
+
+    pthread_mutex_lock(&maps_lock);
+    if ((k = find_map(lo)) < 0) {
+	pthread_mutex_unlock(&maps_lock);
+	return -1;
+    }
+    bytes = maps[k].bytes;
+    maps[k] = maps[--num_maps];
+    pthread_mutex_unlock(&maps_lock);
+
+    munmap(lo, bytes);
+    add_total(-bytes);
+    return 0;
+}
+
+/*
+ * mem_remap - resize a mapping made by mem_map to bytes, rounded up to
+ *    whole pages, like mremap. The kernel moves the pages rather than
+ *    their contents if the mapping cannot grow in place. Returns the
+ *    new start of the mapping, or NULL if lo does not start a mapping
+ *    or it cannot be resized, in which case it is left alone.
+ */
+void *mem_remap(void *lo, size_t bytes)
+{
+    char *new_lo;
+    size_t old_bytes;
+    int k;
+
+    bytes = (bytes + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    pthread_mutex_lock(&maps_lock);
+    if ((k = find_map(lo)) < 0) {
+	pthread_mutex_unlock(&maps_lock);
+	return NULL;
+    }
+    old_bytes = maps[k].bytes;
+    new_lo = mremap(lo, old_bytes, bytes, MREMAP_MAYMOVE);
+    if (new_lo == MAP_FAILED) {
+	pthread_mutex_unlock(&maps_lock);
+	return NULL;
+    }
+    maps[k].lo = new_lo;
+    maps[k].bytes = bytes;
+    pthread_mutex_unlock(&maps_lock);
+
+    add_total(bytes - old_bytes);
+    return new_lo;
+}
+
+/*
+ * mem_is_mapped - return whether the bytes from lo to hi, inclusive,
+ *    all lie in one mapping made by mem_map
+ */
+int mem_is_mapped(const void *lo, const void *hi)
+{
+    int k, found = 0;
+
+    pthread_mutex_lock(&maps_lock);
+    for (k = 0; k < num_maps && !found; k++)
+	found = (const char *)lo >= maps[k].lo && (const char *)hi < maps[k].lo + maps[k].bytes;
+    pthread_mutex_unlock(&maps_lock);
+    return found;
+}
+
+/*
+ * mem_in_heap - return whether an address lies in the range reserved
+ *    for the heap and its arenas, rather than in a mapping
+ */
+int mem_in_heap(const void *p)
+{
+    return (const char *)p >= mem_start_brk && (const char *)p < mem_top;
+}
+
+/*
+ * mem_arena_reset_brk - reset the brk pointer of one arena to make it empty
+ */
+void mem_arena_reset_brk(int arena)
+{
+    assert(arena >= 0 && arena < MAX_ARENAS);
+    __atomic_sub_fetch(&mem_total, mem_arena_heapsize(arena), __ATOMIC_RELAXED);
+    if (arena == 0)
+	mem_brk = mem_start_brk;
+    else
+	arena_brk[arena] = arena_lo(arena);
+}
+
+/*
+ * mem_arena_lo - return address of the first byte of an arena
+ */
+void *mem_arena_lo(int arena)
+{
+    assert(arena >= 0 && arena < MAX_ARENAS);
+    return (void *)arena_lo(arena);
+}
+
+/*
+ * mem_arena_heapsize - returns the size of an arena in bytes
+ */
+size_t mem_arena_heapsize(int arena)
+{
+    assert(arena >= 0 && arena < MAX_ARENAS);
+    return (size_t)((arena == 0 ? mem_brk : arena_brk[arena]) - arena_lo(arena));
+}
+
+/*
+ * mem_arena_bytes - returns the size of the slot of a carved arena,
+ *    the most it can grow to
+ */
+size_t mem_arena_bytes(void)
+{
+    return arena_bytes;
+}
+
+/*
+ * mem_arena_of - return the index of the arena that holds an address
+ *    in the heap. Arenas lie in fixed slots below the top, so this is
+ *    only a subtraction and a shift.
+ */
+int mem_arena_of(const void *p)
+{
+    const char *addr = p;
+
+    /* the limit only drops below blocks already handed out */
+    if (addr < __atomic_load_n(&mem_max_addr, __ATOMIC_RELAXED))
+	return 0;
+    return (int)((size_t)(mem_top - addr - 1) >> arena_shift) + 1;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -77,19 +523,39 @@ void *mem_heap_lo()
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_hi - return address of last heap byte, in the highest
+ *    nonempty arena
  */
 void *mem_heap_hi()
 {
+    int arena;
+
+    for (arena = 1; arena < mem_arenas; arena++)
+	if (arena_brk[arena] > arena_lo(arena))
+	    return (void *)(arena_brk[arena] - 1);
     return (void *)(mem_brk - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, over every arena
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    size_t size = 0;
+    int arena;
+
+    for (arena = 0; arena < mem_arenas; arena++)
+	size += mem_arena_heapsize(arena);
+    return size;
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest mem_heapsize() since the
+ *    last mem_reset_brk, since the heap can shrink
+ */
+size_t mem_peak_heapsize()
+{
+    return __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
 }
 
 /*
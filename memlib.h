@@ -1,5 +1,14 @@
 #include <unistd.h>
 
+/* Arenas are independent heaps carved out of the top of the heap, in
+   slots of mem_arena_bytes() each, which mem_init sizes to the heap */
+#define MAX_ARENAS 8            /* including the heap itself as arena 0 */
+#define MIN_ARENA_BYTES (1<<20) /* 1 MB, the smallest slot */
+
+#define HUGE_PAGE_BYTES (2<<20) /* the usual x86 huge page */
+
+void mem_configure(size_t max_heap, int huge);
+
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
@@ -7,5 +16,22 @@ void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
 size_t mem_pagesize(void);
+void mem_release(void *lo, size_t bytes);
+
+void *mem_map(size_t bytes);
+int mem_unmap(void *lo);
+void *mem_remap(void *lo, size_t bytes);
+int mem_is_mapped(const void *lo, const void *hi);
+int mem_in_heap(const void *p);
+
+int mem_arena_new(void);
+void *mem_arena_sbrk(int arena, int incr);
+void mem_arena_reset_brk(int arena);
+void *mem_arena_lo(int arena);
+void *mem_arena_fresh(int arena);
+size_t mem_arena_heapsize(int arena);
+size_t mem_arena_bytes(void);
+int mem_arena_of(const void *p);
 
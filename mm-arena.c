@@ -0,0 +1,9 @@
+/*
+ * mm-arena.c - mm-double.c with a heap of its own for every thread.
+ *
+ * Threads never contend for a lock unless there are more of them than arenas,
+ * and freeing another thread's block only pushes it onto a lock-free list.
+ * See ARENAS in mm-double.c.
+ */
+#define ARENAS
+#include "mm-double.c"
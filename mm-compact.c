@@ -0,0 +1,677 @@
+/*
+ * mm-compact.c - A 64-bit clean malloc implementation based on segregated free lists
+ * on a heap of 4-byte boundary tags.
+ *
+ * A unit is 64 bits, and a block is a whole number of units.
+ * A block starts with a 4-byte header packing its size in units,
+ * whether it is allocated, and whether the block before it in the heap is allocated.
+ * Only a free block has a footer, a copy of its header in its last 4 bytes,
+ * so an allocated block costs 4 bytes and the smallest block is 2 units,
+ * against 16 bytes and 3 units for mm-double.c on 32-bit.
+ * The heap starts with 4 bytes of padding so that every payload is 8-byte aligned,
+ * and ends with an allocated epilogue header of size 0,
+ * so that neither end of the heap needs a bounds check.
+ *
+ * A free block's payload holds the links of a doubly-linked free list,
+ * as 32-bit offsets of payloads from the start of the heap in units,
+ * so the layout is the same whatever the size of a pointer.
+ * 0 is the null link; it would be the epilogue's payload in an empty heap.
+ * The class of a block is derived from its size rather than stored:
+ * + Exact (2 units, 3, ..., 8)
+ * + Power of 2 (9-15, 16-31, ...), the last taking every larger size
+ * A bitmap of non-empty classes finds the next larger class with one bit scan.
+ * Freed blocks are immediately coalesced with their free neighbours.
+ * mm_memalign pads its request by enough to find an aligned payload at least
+ * a whole block into it, and splits off and frees the leading part and the end.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define DEBUG
+#ifdef DEBUG
+#include <assert.h>
+#else
+#define assert(...)
+#endif
+
+// count what the allocator does for mm_stats, e.g. with make DEBUG=-DSTATS
+//#define STATS
+
+
+/*********************************************************
+ * NOTE TO STUDENTS: Before you do anything else, please
+ * provide your team information in the following struct.
+ ********************************************************/
+team_t team = {
+  /* Team name */
+  "ateam",
+  /* First member's full name */
+  "Harry Bovik",
+  /* First member's email address */
+  "bovik@cs.cmu.edu",
+  /* Second member's full name (leave blank if none) */
+  "",
+  /* Second member's email address (leave blank if none) */
+  ""
+};
+
+enum {
+  UNIT_BYTES = 8,
+  TAG_BYTES = 4,
+  // header, 2 links and footer
+  MIN_BLOCK_UNITS = 2,
+  MAX_EXACT_UNITS = 8,
+  NUM_EXACT_CLASSES = MAX_EXACT_UNITS - MIN_BLOCK_UNITS + 1,
+  NUM_CLASSES = 32,
+
+  ALLOC = 1,
+  PREV_ALLOC = 2,
+  SIZE_SHIFT = 2
+};
+
+#define MAX_UNITS (UINT32_MAX >> SIZE_SHIFT)
+
+typedef uint32_t tag_t; // size in units << SIZE_SHIFT | PREV_ALLOC | ALLOC
+typedef uint32_t link_t; // offset of a payload from the start of the heap in units, or 0
+
+typedef struct {
+  link_t prev;
+  link_t next;
+} links_t;
+
+static char *heap;
+static tag_t *epilogue;
+static link_t heads[NUM_CLASSES];
+static unsigned nonempty; // bit i is set iff heads[i] != 0
+#ifdef STATS
+static mm_stats_t stats; // all but the free list lengths, which are counted by mm_stats
+#define tally(counter, n) (stats.counter += (n))
+#else
+#define tally(counter, n)
+#endif
+
+static size_t bytes_to_units(size_t);
+static int get_class_index(size_t);
+static size_t get_size(tag_t *);
+static tag_t *get_header(void *);
+static void *get_payload(tag_t *);
+static links_t *get_links(tag_t *);
+static link_t to_link(tag_t *);
+static tag_t *from_link(link_t);
+static tag_t *get_next_in_heap(tag_t *);
+static tag_t *get_prev_in_heap(tag_t *);
+static void set_tags(tag_t *, size_t, int);
+static void set_prev_alloc(tag_t *, int);
+static void insert_block(tag_t *);
+static void remove_block(tag_t *);
+static tag_t *find_block(size_t);
+static tag_t *release_block(tag_t *);
+static void split_block(tag_t *, size_t);
+static void *allocate(size_t);
+static void *allocate_aligned(size_t, size_t);
+static tag_t *grow_heap(size_t);
+
+/*
+ * bytes_to_units - converts a payload in bytes to the total units of its block
+ */
+inline static size_t bytes_to_units(const size_t bytes) {
+  assert(bytes);
+  const size_t units = (bytes + TAG_BYTES + UNIT_BYTES - 1) / UNIT_BYTES;
+  return units < MIN_BLOCK_UNITS ? MIN_BLOCK_UNITS : units;
+}
+
+/*
+ * get_class_index - gets the class of a block by its total units
+ */
+inline static int get_class_index(const size_t units) {
+  assert(units >= MIN_BLOCK_UNITS);
+  if (units <= MAX_EXACT_UNITS)
+    return units - MIN_BLOCK_UNITS;
+
+  // 9-15 is the first power-of-2 class
+  const int i = NUM_EXACT_CLASSES + (31 - __builtin_clz((unsigned)units)) - 3;
+  return i < NUM_CLASSES ? i : NUM_CLASSES - 1;
+}
+
+/*
+ * get_size - gets a block's total number of units, including its tags
+ */
+inline static size_t get_size(tag_t *const block) {
+  return *block >> SIZE_SHIFT;
+}
+
+/*
+ * get_header - gets a payload's header
+ */
+inline static tag_t *get_header(void *const payload) {
+  tag_t *const header = (tag_t *)payload - 1;
+  if ((uintptr_t)payload % UNIT_BYTES != 0
+      || (char *)header < heap + TAG_BYTES || header >= epilogue
+      || get_size(header) < MIN_BLOCK_UNITS
+      || get_next_in_heap(header) > epilogue) {
+    fprintf(stderr, "%p is not a valid block\n", payload);
+    abort();
+  }
+  if (!(*header & ALLOC)) {
+    fprintf(stderr, "%p is the payload of an already freed block\n", payload);
+    abort();
+  }
+  return header;
+}
+
+/*
+ * get_payload - gets a block's payload
+ */
+inline static void *get_payload(tag_t *const block) {
+  return block + 1;
+}
+
+/*
+ * get_links - gets the free list links in a free block's payload
+ */
+inline static links_t *get_links(tag_t *const block) {
+  assert(!(*block & ALLOC));
+  return get_payload(block);
+}
+
+/*
+ * to_link - gets the link to a block
+ */
+inline static link_t to_link(tag_t *const block) {
+  return ((char *)get_payload(block) - heap) / UNIT_BYTES;
+}
+
+/*
+ * from_link - gets the block a link points to
+ */
+inline static tag_t *from_link(const link_t link) {
+  assert(link);
+  return (tag_t *)(heap + (size_t)link * UNIT_BYTES) - 1;
+}
+
+/*
+ * get_next_in_heap - get the block immediately after a given block in the heap, NOT the free list
+ */
+inline static tag_t *get_next_in_heap(tag_t *const block) {
+  return (tag_t *)((char *)block + get_size(block) * UNIT_BYTES);
+}
+
+/*
+ * get_prev_in_heap - get the block immediately before a given block in the heap
+ *  only valid if that block is free, since only then does it have a footer.
+ */
+inline static tag_t *get_prev_in_heap(tag_t *const block) {
+  assert(!(*block & PREV_ALLOC));
+  const tag_t *const footer = block - 1;
+  tag_t *const prev = (tag_t *)((char *)block - (*footer >> SIZE_SHIFT) * UNIT_BYTES);
+  assert(get_size(prev) == *footer >> SIZE_SHIFT);
+  return prev;
+}
+
+/*
+ * set_tags - sets a block's size and whether it is allocated, keeping its PREV_ALLOC bit.
+ *  a free block also gets its footer.
+ */
+inline static void set_tags(tag_t *const block, const size_t units, const int alloc) {
+  assert(units <= MAX_UNITS);
+  *block = units << SIZE_SHIFT | (*block & PREV_ALLOC) | (alloc ? ALLOC : 0);
+  if (!alloc)
+    *(get_next_in_heap(block) - 1) = *block;
+}
+
+/*
+ * set_prev_alloc - sets whether the block before a given block is allocated.
+ *  the footer of a free block is left alone, since only its size is ever read.
+ */
+inline static void set_prev_alloc(tag_t *const block, const int alloc) {
+  if (alloc)
+    *block |= PREV_ALLOC;
+  else
+    *block &= ~PREV_ALLOC;
+}
+
+/*
+ * insert_block - frees a block and pushes it onto the head of its list
+ */
+static void insert_block(tag_t *const block) {
+  const size_t units = get_size(block);
+  const int i = get_class_index(units);
+
+  set_tags(block, units, 0);
+  links_t *const links = get_links(block);
+  links->prev = 0;
+  links->next = heads[i];
+  if (links->next)
+    get_links(from_link(links->next))->prev = to_link(block);
+  heads[i] = to_link(block);
+  nonempty |= 1u << i;
+
+  set_prev_alloc(get_next_in_heap(block), 0);
+}
+
+/*
+ * remove_block - removes a free block from its list and marks it allocated
+ */
+static void remove_block(tag_t *const block) {
+  const size_t units = get_size(block);
+  const int i = get_class_index(units);
+  links_t *const links = get_links(block);
+
+  if (!links->prev) {
+    assert(heads[i] == to_link(block));
+    heads[i] = links->next;
+    if (!links->next)
+      nonempty &= ~(1u << i);
+  } else
+    get_links(from_link(links->prev))->next = links->next;
+  if (links->next)
+    get_links(from_link(links->next))->prev = links->prev;
+
+  set_tags(block, units, 1);
+  set_prev_alloc(get_next_in_heap(block), 1);
+}
+
+/*
+ * find_block - finds a free block of at least units in total
+ *  takes the first fit in the block's own class, then the head of the next non-empty class.
+ *  returns NULL if no class has a fit.
+ */
+static tag_t *find_block(const size_t units) {
+  const int i = get_class_index(units);
+
+  link_t link;
+  for (link = heads[i]; link; link = get_links(from_link(link))->next) {
+    tally(fit_steps, 1);
+    tag_t *const block = from_link(link);
+    if (get_size(block) >= units)
+      return block;
+  }
+
+  const unsigned larger = i + 1 < NUM_CLASSES ? nonempty & (~0u << (i + 1)) : 0;
+  if (larger == 0)
+    return NULL;
+  tally(escalations, 1);
+  tag_t *const block = from_link(heads[__builtin_ctz(larger)]);
+  assert(get_size(block) >= units);
+  return block;
+}
+
+/*
+ * release_block - frees an allocated block after merging it with its free neighbours in the heap
+ *  returns the merged block.
+ */
+static tag_t *release_block(tag_t *block) {
+  assert(*block & ALLOC);
+  size_t units = get_size(block);
+
+  tag_t *const right = get_next_in_heap(block);
+  if (!(*right & ALLOC)) {
+    remove_block(right);
+    units += get_size(right);
+    tally(coalesces, 1);
+  }
+
+  if (!(*block & PREV_ALLOC)) {
+    tag_t *const left = get_prev_in_heap(block);
+    remove_block(left);
+    units += get_size(left);
+    block = left;
+    tally(coalesces, 1);
+  }
+
+  // an allocated tag gets the size without writing a footer inside the merged block
+  set_tags(block, units, 1);
+  insert_block(block);
+  return block;
+}
+
+/*
+ * split_block - shrinks an allocated block to units in total, freeing the rest.
+ *  does NOT split if the rest is too small to be a block.
+ */
+static void split_block(tag_t *const block, const size_t units) {
+  assert(*block & ALLOC);
+  const size_t size = get_size(block);
+  assert(units <= size);
+
+  if (size - units < MIN_BLOCK_UNITS)
+    return;
+
+  set_tags(block, units, 1);
+  tally(splits, 1);
+
+  tag_t *const right = get_next_in_heap(block);
+  *right = PREV_ALLOC;
+  set_tags(right, size - units, 1);
+  release_block(right);
+}
+
+/*
+ * allocate - allocates a block of units in total
+ *  extends a free block at the end of the heap rather than leaving it behind.
+ *  returns the payload or NULL on heap failure.
+ */
+static void *allocate(const size_t units) {
+  tag_t *block = find_block(units);
+  if (block == NULL) {
+    const size_t last = *epilogue & PREV_ALLOC ? 0 : get_size(get_prev_in_heap(epilogue));
+    block = grow_heap(units - last);
+    if (block == NULL)
+      return NULL;
+  }
+
+  remove_block(block);
+  split_block(block, units);
+  return get_payload(block);
+}
+
+/*
+ * allocate_aligned - allocates a block of units in total whose payload is
+ *  a multiple of alignment bytes, a power of 2.
+ *  the block found is padded so that an aligned payload at least a block into it fits,
+ *  and the padding before it is freed as a block of its own.
+ *  returns the payload or NULL on heap failure.
+ */
+static void *allocate_aligned(const size_t alignment, const size_t units) {
+  // every payload in the heap is a unit apart from the next
+  if (alignment <= UNIT_BYTES)
+    return allocate(units);
+
+  const size_t padded = units + MIN_BLOCK_UNITS + alignment / UNIT_BYTES - 1;
+  if (padded > MAX_UNITS)
+    return NULL;
+  char *const payload = allocate(padded);
+  if (payload == NULL)
+    return NULL;
+  tag_t *block = (tag_t *)payload - 1;
+
+  char *aligned = (char *)(((uintptr_t)payload + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  if (aligned != payload && (size_t)(aligned - payload) < MIN_BLOCK_UNITS * UNIT_BYTES)
+    aligned += alignment;
+  if (aligned != payload) {
+    const size_t lead = (aligned - payload) / UNIT_BYTES;
+    tag_t *const right = (tag_t *)aligned - 1;
+    // freeing the padding clears PREV_ALLOC
+    *right = PREV_ALLOC;
+    set_tags(right, get_size(block) - lead, 1);
+
+    set_tags(block, lead, 1);
+    tally(splits, 1);
+    release_block(block);
+    block = right;
+  }
+
+  split_block(block, units);
+  return aligned;
+}
+
+/*
+ * grow_heap - grows the heap by units, freeing them as a block
+ *  returns the free block, merged with a free last block, or NULL on failure
+ */
+static tag_t *grow_heap(const size_t units) {
+  assert(units);
+
+  const size_t prev_heapsize = mem_heapsize();
+  int64_t bytes;
+  for (bytes = units * (int64_t)UNIT_BYTES; bytes >= INT_MAX; bytes -= INT_MAX)
+    if (mem_sbrk(INT_MAX) == (void *)-1)
+      goto heapfail;
+  if (bytes && mem_sbrk(bytes) == (void *)-1)
+    goto heapfail;
+  tally(grows, 1);
+  tally(grow_bytes, units * UNIT_BYTES);
+
+  // the old epilogue becomes the header of the new block
+  tag_t *const block = epilogue;
+  set_tags(block, units, 1);
+  epilogue = get_next_in_heap(block);
+  *epilogue = PREV_ALLOC | ALLOC;
+  return release_block(block);
+
+ heapfail:
+  mem_reset_brk();
+  mem_sbrk(prev_heapsize);
+  return NULL;
+}
+
+/*
+ * mm_init - initialize the malloc package.
+ */
+int mm_init(void) {
+  memset(heads, 0, sizeof(heads));
+  nonempty = 0;
+#ifdef STATS
+  memset(&stats, 0, sizeof(stats));
+#endif
+
+  // padding and the epilogue
+  heap = mem_sbrk(2 * TAG_BYTES);
+  if (heap == (void *)-1)
+    return -1;
+  epilogue = (tag_t *)(heap + TAG_BYTES);
+  *epilogue = PREV_ALLOC | ALLOC;
+
+  return 0;
+}
+
+/*
+ * mm_malloc - Allocate a block.
+ *  If size == 0, returns NULL as a "success."
+ *  If size > 0, returns non-NULL on success, NULL on failure to grow the heap.
+ */
+void *mm_malloc(const size_t size) {
+  if (size == 0)
+    return NULL;
+  if (size / UNIT_BYTES >= MAX_UNITS)
+    return NULL;
+  return allocate(bytes_to_units(size));
+}
+
+/*
+ * mm_free - Frees a block.
+ *  will abort program if ptr is certainly not an allocated block.
+ */
+void mm_free(void *const ptr) {
+  if (ptr != NULL)
+    release_block(get_header(ptr));
+}
+
+/*
+ * mm_calloc - Allocate a block of nmemb * size bytes that are all zero,
+ *  clearing all of it only if it was not carved past what the heap ever used.
+ *  If either is 0, returns NULL as a "success."
+ *  Otherwise, returns non-NULL on success, NULL on failure to grow the heap
+ *  or if the product overflows.
+ */
+void *mm_calloc(const size_t nmemb, const size_t size) {
+  if (nmemb == 0 || size == 0 || nmemb > SIZE_MAX / size)
+    return NULL;
+  const size_t bytes = nmemb * size;
+  char *const fresh = mem_arena_fresh(0);
+  char *const payload = mm_malloc(bytes);
+  if (payload == NULL)
+    return NULL;
+  if (payload < fresh) {
+    memset(payload, 0, bytes);
+    return payload;
+  }
+
+  // grow_heap freed the block before it was allocated, writing its links and footer
+  const size_t usable = get_size(get_header(payload)) * UNIT_BYTES - TAG_BYTES;
+  memset(payload, 0, sizeof(links_t));
+  memset(payload + usable - TAG_BYTES, 0, TAG_BYTES);
+  return payload;
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload is a multiple of alignment, a power of 2.
+ *  If size == 0, returns NULL as a "success."
+ *  If size > 0, returns non-NULL on success, NULL on failure to grow the heap
+ *  or if alignment is not a power of 2.
+ */
+void *mm_memalign(const size_t alignment, const size_t size) {
+  if (size == 0 || alignment == 0 || (alignment & (alignment - 1)))
+    return NULL;
+  if (size / UNIT_BYTES >= MAX_UNITS)
+    return NULL;
+  return allocate_aligned(alignment, bytes_to_units(size));
+}
+
+/*
+ * mm_free_sized - Frees a block of size bytes, as it was allocated or reallocated with,
+ *  or as mm_usable_size gave for it. An allocated block has no footer to skip,
+ *  so this only checks the size too.
+ *  will abort program if ptr is certainly not an allocated block of that size.
+ */
+void mm_free_sized(void *const ptr, const size_t size) {
+  if (ptr == NULL)
+    return;
+  tag_t *const header = get_header(ptr);
+  if (size > get_size(header) * UNIT_BYTES - TAG_BYTES) {
+    fprintf(stderr, "%p is not a valid block of %u bytes\n", ptr, (unsigned)size);
+    abort();
+  }
+  release_block(header);
+}
+
+/*
+ * mm_usable_size - Gets how many bytes a block can hold, at least as many as it was
+ *  allocated with, all of which are the caller's to use. Returns 0 for NULL.
+ *  will abort program if ptr is certainly not an allocated block.
+ */
+size_t mm_usable_size(void *const ptr) {
+  if (ptr == NULL)
+    return 0;
+  return get_size(get_header(ptr)) * UNIT_BYTES - TAG_BYTES;
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into ptrs, rounding the size once.
+ *  returns how many were allocated, which is n unless the heap failed to grow,
+ *  or none if size == 0.
+ */
+size_t mm_malloc_batch(const size_t size, void **const ptrs, const size_t n) {
+  size_t k = 0;
+  if (size == 0 || size / UNIT_BYTES >= MAX_UNITS)
+    return 0;
+  const size_t units = bytes_to_units(size);
+  while (k < n && (ptrs[k] = allocate(units)) != NULL)
+    k++;
+  return k;
+}
+
+/*
+ * mm_free_batch - Frees n blocks from ptrs.
+ *  will abort program if any of them is certainly not an allocated block.
+ */
+void mm_free_batch(void **const ptrs, const size_t n) {
+  size_t k;
+  for (k = 0; k < n; k++)
+    if (ptrs[k] != NULL)
+      release_block(get_header(ptrs[k]));
+}
+
+/*
+ * mm_realloc - Resizes a block in place if its right neighbour or the heap allows,
+ *  otherwise moves it.
+ *  A NULL return is a success if bytes == 0, a failure otherwise.
+ *  will abort program if ptr is certainly not an allocated block.
+ */
+void *mm_realloc(void *const ptr, const size_t bytes) {
+  if (ptr == NULL)
+    return mm_malloc(bytes);
+
+  if (bytes == 0) {
+    mm_free(ptr);
+    return NULL;
+  }
+
+  tag_t *const block = get_header(ptr);
+  if (bytes / UNIT_BYTES >= MAX_UNITS)
+    return NULL;
+  const size_t prev_size = get_size(block);
+  const size_t size = bytes_to_units(bytes);
+
+  // if smaller size, attempt to split the block
+  if (size <= prev_size) {
+    tally(realloc_shrink, 1);
+    split_block(block, size);
+    return ptr;
+  }
+
+  // absorb a free right neighbour, growing the heap under it if it ends the heap
+  tag_t *right = get_next_in_heap(block);
+  const int is_free = !(*right & ALLOC);
+  size_t total = prev_size + (is_free ? get_size(right) : 0);
+  if (total < size && (right == epilogue || (is_free && get_next_in_heap(right) == epilogue))) {
+    // a new block on its own must still be a whole block
+    const size_t units = right == epilogue && size - total < MIN_BLOCK_UNITS ?
+      MIN_BLOCK_UNITS : size - total;
+    right = grow_heap(units);
+    if (right == NULL)
+      return NULL;
+    total += units;
+    tally(realloc_grow, 1);
+  } else if (total >= size)
+    tally(realloc_right, 1);
+
+  if (total >= size) {
+    remove_block(right);
+    set_tags(block, total, 1);
+    split_block(block, size);
+    return ptr;
+  }
+
+  void *const newPtr = allocate(size);
+  if (newPtr == NULL)
+    return NULL;
+  tally(realloc_move, 1);
+  memcpy(newPtr, ptr, prev_size * UNIT_BYTES - TAG_BYTES);
+  release_block(block);
+
+  return newPtr;
+}
+
+/*
+ * mm_stats - fills in the counters, with a class for each list.
+ *  returns -1 without STATS.
+ */
+int mm_stats(mm_stats_t *const out) {
+#ifdef STATS
+  *out = stats;
+  out->num_classes = NUM_CLASSES;
+
+  int i;
+  for (i = 0; i < NUM_CLASSES; i++) {
+    link_t link;
+    for (link = heads[i]; link; link = get_links(from_link(link))->next)
+      out->free_blocks[i]++;
+  }
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/*
+ * mm_heap_walk - calls walk on every block in the heap up to the epilogue, with a class for each list.
+ *  returns the number of classes.
+ */
+int mm_heap_walk(const mm_walk_t walk, void *const arg) {
+  tag_t *block;
+  for (block = (tag_t *)(heap + TAG_BYTES); block < epilogue; block = get_next_in_heap(block)) {
+    const mm_block_t b = {
+      get_payload(block), get_size(block) * UNIT_BYTES - TAG_BYTES, *block & ALLOC,
+      get_class_index(get_size(block))
+    };
+    walk(&b, arg);
+  }
+  return NUM_CLASSES;
+}
@@ -9,24 +9,104 @@
  * + 1 block for the footer.
  * If the block is free then the first payload block contains data
  * as a node in a doubly-linked list.
+ * With FOOTERS_FREE (ELIDE_FOOTERS), only a free block has a footer, and an allocated block's
+ * payload takes over the unit instead; every header records whether
+ * the block before it is allocated, which is all coalescing needs to know.
+ * It is single-threaded only.
+ * With FOOTERS_NONE, no block has a footer, so blocks only merge to the right.
  * The heap itself is an implicit doubly linked list,
- * allowing for reallocated blocks to left-coalesce if possible.
+ * allowing for reallocated blocks to left-coalesce if possible,
+ * or a singly linked one without footers.
+ * With COALESCE_FREE (COALESCE_ON_FREE), a freed block is also merged with
+ * its free neighbours before it is added to its free list.
+ * With COALESCE_DEFERRED (DEFERRED_COALESCE as well), the small classes are instead LIFO quick lists
+ * that are left alone until a sweep merges the whole heap,
+ * which only happens right before the heap would have to grow.
+ * With TRIM, a merged free block of at least TRIM_BYTES is given back,
+ * whether merged on free or by the sweep:
+ * the heap shrinks if the block ends it, otherwise the pages inside it are released.
+ * It needs coalescing, as COALESCE_NONE never merges a freed block.
  * 
- * There are 10 classes by payload size:
+ * By default there are 11 classes by payload size, SMALL_CLASSES and MEDIUM_CLASSES
+ * change how many of the first two kinds there are:
  * + Small (1 unit, 2, 3, ..., 7)
- * + Medium (8-15, 16-31, 32-63)
+ * + Medium (8-15, 16-31, 32-63), where FIT picks the block
  * + Large (>=64)
+ * With CLASS_TABLE, the classes are instead looked up in a table generated from traces,
+ * where the small classes are the leading ones of a single size.
+ * The large class is not a list but a bitwise trie keyed on size,
+ * so it gives the best fit in time bounded by the width of the size field.
+ * Blocks of the same size as a node in the trie are chained off that node.
+ * A bitmap of the classes that have free blocks finds
+ * the next larger class with a single bit scan.
+ *
+ * With THREADS, every thread allocates and frees small blocks through
+ * a cache of its own, which only takes the heap lock to refill from
+ * or flush to the free lists in batches.
+ * Cached blocks look allocated to the rest of the heap.
+ * Everything else holds the heap lock, since coalescing can reach into the lists of any class.
+ *
+ * With ARENAS, every thread is instead attached to an arena, a heap of its own
+ * carved out of the top of memlib's heap, and holds only that arena's lock.
+ * A block freed by a thread of another arena is pushed onto the owning arena's
+ * remote list without any lock, and the owner frees it on its next malloc.
+ * The arena of a block is found from its address alone.
+ * A request that a full arena has no room for falls back to arena 0, the heap itself.
+ *
+ * With SLABS, requests of up to MAX_SLAB_BYTES are instead slots in runs,
+ * pages carved out of a memlib arena of their own, so they have no header at all.
+ * Every run holds slots of one size, and a bitmap of which of them are free
+ * at its start, where the run of a slot is found by masking its offset into the arena.
+ * Runs with a free slot are listed by size, and so are runs with none in use,
+ * which can be taken for any size. Once the runs fill the arena,
+ * small requests fall through to the free lists.
+ *
+ * With MMAP, requests of at least MMAP_BYTES are instead mappings of their own
+ * apart from the heap, a header unit followed by the payload, which are unmapped when freed
+ * and resized by remapping their pages, so growing one never copies it.
+ * A block is mapped iff it lies outside the heap.
+ *
+ * mm_malloc_batch takes the class of its size once and, for a small class,
+ * hands out the whole free list before carving what is left from a single
+ * extension of the heap once no larger class has a free block to split.
+ * mm_free_batch takes the lock once, and links the small blocks of each class
+ * into a chain that is spliced onto the head of its quick list at once.
+ * With THREADS, the small blocks of a batch go through the cache instead.
+ *
+ * mm_calloc clears only what is not fresh. A mapping is fresh, and so is a block
+ * that allocate_next carves past the end of the part of the arena ever in use,
+ * which memlib keeps. Small blocks, which are most likely recycled, are simply
+ * allocated and cleared; large recycled ones are cleared with non-temporal stores.
+ *
+ * mm_memalign allocates from the heap, padded by enough to find an aligned payload
+ * at least a whole block into it, whose leading part and end are split off and freed.
+ * Being slack, the padding is taken from a larger class rather than searched for,
+ * and it is merged at once rather than deferred, as no request is likely to fit it.
+ *
+ * With REALLOC_SLACK, a block that realloc has to copy is moved into
+ * a quarter more than it asked for, up to REALLOC_SLACK_BYTES, and keeps that slack
+ * when it shrinks by less, so a buffer that keeps growing is copied
+ * a logarithmic number of times rather than on every growth.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
+#if defined(THREADS) || defined(ARENAS)
+#include <pthread.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
 
-#define DEBUG
+// check the heap as it goes, asserting on every footer and list it passes,
+// and log what realloc does, e.g. with make DEBUG="-g -DDEBUG"
+//#define DEBUG
 #ifdef DEBUG
 #include <assert.h>
 #define log(...) printf(__VA_ARGS__)
@@ -37,6 +117,116 @@
 #define aprintf(...) 
 #endif
 
+// Every policy can be picked at build time, e.g. with
+// make DEBUG="-DFOOTERS=FOOTERS_NONE -DFIT=FIT_BEST -DNO_SLABS"
+
+// which blocks have footers:
+// FOOTERS_ALL, every block, so the heap is doubly linked;
+// FOOTERS_FREE, only free blocks, so an allocated block has a unit more of payload;
+// FOOTERS_NONE, no block, so the heap is singly linked and blocks only merge to the right
+#define FOOTERS_ALL 0
+#define FOOTERS_FREE 1
+#define FOOTERS_NONE 2
+#ifndef FOOTERS
+#define FOOTERS FOOTERS_FREE
+#endif
+#if FOOTERS == FOOTERS_FREE && (defined(THREADS) || defined(ARENAS))
+// a neighbour's prev_alloc is written under the lock into a header its owner reads without it
+#undef FOOTERS
+#define FOOTERS FOOTERS_ALL
+#endif
+#if FOOTERS == FOOTERS_FREE
+#define ELIDE_FOOTERS
+#endif
+
+// when freed blocks are merged with their free neighbours in the heap:
+// COALESCE_NONE, only when realloc grows a block into them;
+// COALESCE_FREE, as soon as they are freed;
+// COALESCE_DEFERRED, as soon as large blocks are freed, but small ones only
+// once the heap would otherwise grow
+#define COALESCE_NONE 0
+#define COALESCE_FREE 1
+#define COALESCE_DEFERRED 2
+#ifndef COALESCE
+#define COALESCE COALESCE_DEFERRED
+#endif
+#if COALESCE != COALESCE_NONE
+#define COALESCE_ON_FREE
+#endif
+#if COALESCE == COALESCE_DEFERRED
+#define DEFERRED_COALESCE
+#endif
+
+// which block of a medium class is taken, the large class always taking the best fit:
+// FIT_FIRST, the first that fits;
+// FIT_BEST, the smallest that fits;
+// FIT_NEXT, the first that fits after where the last search of the class stopped
+#define FIT_FIRST 0
+#define FIT_BEST 1
+#define FIT_NEXT 2
+#ifndef FIT
+#define FIT FIT_FIRST
+#endif
+
+// take the classes from classes.h, as gen_classes.pl made them from traces, e.g. with
+// make classes.h && make DEBUG=-DCLASS_TABLE
+//#define CLASS_TABLE
+#ifdef CLASS_TABLE
+#include "classes.h"
+#endif
+// otherwise, how many small classes of exact sizes there are, one less than a power of 2,
+// and how many medium classes of powers of 2 follow them
+#ifndef SMALL_CLASSES
+#define SMALL_CLASSES 7
+#endif
+#ifndef MEDIUM_CLASSES
+#define MEDIUM_CLASSES 3
+#endif
+#if SMALL_CLASSES + MEDIUM_CLASSES >= 32
+#error "there must be at most 32 classes"
+#endif
+#if !defined(CLASS_TABLE) && (SMALL_CLASSES + 1) & SMALL_CLASSES
+#error "SMALL_CLASSES must be one less than a power of 2"
+#endif
+
+// serve small requests from runs of equal slots without headers
+#ifndef NO_SLABS
+#define SLABS
+#endif
+#if defined(SLABS) && (defined(THREADS) || defined(ARENAS))
+// THREADS has its own front end for small blocks, and ARENAS takes every memlib arena
+#undef SLABS
+#endif
+// give back large free blocks, at the cost of faulting their pages back in if they are reused,
+// which only coalescing makes, so not with COALESCE_NONE,
+// e.g. with make DEBUG="-DTRIM -DTRIM_BYTES=65536"
+//#define TRIM
+#ifndef TRIM_BYTES
+#define TRIM_BYTES (128 << 10)
+#endif
+// give a block that realloc has to move room to grow into, up to REALLOC_SLACK_BYTES,
+// so that it is not moved again on its next growth
+#ifndef NO_REALLOC_SLACK
+#define REALLOC_SLACK
+#endif
+#ifndef REALLOC_SLACK_BYTES
+#define REALLOC_SLACK_BYTES (16 << 10)
+#endif
+// serve large requests from mappings apart from the heap, e.g. with make DEBUG=-DMMAP_BYTES=1048576
+#ifndef NO_MMAP
+#define MMAP
+#endif
+#ifndef MMAP_BYTES
+#define MMAP_BYTES (128 << 10)
+#endif
+// calloc clears recycled blocks of at least this many bytes around the cache, with SSE2,
+// below MMAP_BYTES so that heap blocks get there, since mappings come cleared
+#ifndef STREAM_BYTES
+#define STREAM_BYTES (64 << 10)
+#endif
+// count what the allocator does for mm_stats, e.g. with make DEBUG=-DSTATS
+//#define STATS
+
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -56,23 +246,31 @@ team_t team = {
 };
 
 enum {
-  NUM_SMALL_CLASSES = 7,
-  NUM_MEDIUM_CLASSES = 3,
+  NUM_SMALL_CLASSES = SMALL_CLASSES,
+  NUM_MEDIUM_CLASSES = MEDIUM_CLASSES,
   NUM_CLASSES = NUM_SMALL_CLASSES
   + NUM_MEDIUM_CLASSES + 1,
+  LARGE_CLASS = NUM_CLASSES - 1,
   
+  SIZE_BITS = 29,
   UNIT_BYTES = 8,
-  MIN_BLOCK_UNITS = 3
+  MIN_BLOCK_UNITS = 2 + (FOOTERS != FOOTERS_NONE) // header, payload, footer
 };
 
 typedef struct {
   char data[UNIT_BYTES];
 } unit_t;
 
+#ifdef CLASS_TABLE
+_Static_assert(CLASS_TABLE_UNIT_BYTES == UNIT_BYTES, "classes.h was generated for another UNIT_BYTES");
+#endif
+
 // size is 1 less than the payload size in units
+// prev_alloc is whether the block before is allocated, only kept with ELIDE_FOOTERS
 // i is the class index
-#define SIZE_INFO size_t size: 29; \
-  unsigned padding: 2; \
+#define SIZE_INFO size_t size: SIZE_BITS; \
+  unsigned padding: 1; \
+  unsigned prev_alloc: 1; \
   unsigned alloc: 1;   \
   int i
 
@@ -88,55 +286,249 @@ typedef struct {
 
 #undef SIZE_INFO
 
-static struct {
-  header_t *head;
-  header_t *last;
-} classes[NUM_CLASSES];
-static unit_t *next;
+// a free block of the large class that is a node in the trie.
+// prev is NULL only for the node itself, not for the blocks chained off it.
+typedef struct tree {
+  header_t header;
+  struct tree *child[2];
+  struct tree *parent;
+} tree_t;
+
+#if defined(THREADS) && defined(ARENAS)
+#error "THREADS and ARENAS are exclusive"
+#endif
+
+// a heap of its own: the free lists over one arena of memlib
+typedef struct {
+  struct {
+    header_t *head;
+    header_t *last;
+  } classes[NUM_CLASSES];
+  unsigned nonempty; // bit i is set iff classes[i] has a free block
+#if FIT == FIT_NEXT
+  header_t *rover[NUM_CLASSES]; // where the next search of each medium class starts, NULL for its head
+#endif
+  unit_t *lo;
+  unit_t *next;
+  int index; // the memlib arena
+#ifdef ELIDE_FOOTERS
+  unsigned last_alloc; // whether the last block is allocated, the prev_alloc of the next one
+#endif
+#ifdef DEFERRED_COALESCE
+  size_t deferred; // small blocks freed since the last sweep
+#endif
+#if defined(THREADS) || defined(ARENAS)
+  pthread_mutex_t lock;
+#endif
+#ifdef ARENAS
+  unsigned threads; // threads attached to the arena
+  header_t *remote; // blocks freed by threads of other arenas, linked through next
+#endif
+#ifdef STATS
+  mm_stats_t stats; // all but the free list lengths, which are counted by mm_stats
+#endif
+} arena_t;
+
+#ifdef STATS
+#define tally(counter, n) (arena->stats.counter += (n))
+#else
+#define tally(counter, n)
+#endif
+
+#if defined(THREADS) || defined(ARENAS)
+static unsigned generation; // bumped by mm_init, so what threads kept from before is dropped
+
+// locks the calling thread's arena, the whole heap without ARENAS
+#define lock_heap() pthread_mutex_lock(&arena->lock)
+#define unlock_heap() pthread_mutex_unlock(&arena->lock)
+#else
+#define lock_heap()
+#define unlock_heap()
+#endif
+
+#ifdef ARENAS
+static arena_t arenas[MAX_ARENAS];
+static int num_arenas;
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER; // for attaching and carving arenas
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static pthread_key_t arena_key;
+static __thread arena_t *arena; // the calling thread's arena
+static __thread unsigned arena_generation; // the generation arena belongs to
+#else
+static arena_t heap;
+static arena_t *const arena = &heap;
+#endif
+
+#ifdef THREADS
+enum {
+  CACHE_LIMIT = 32, // most blocks a thread keeps per small class
+  CACHE_BATCH = 16  // blocks moved per refill or flush
+};
+
+typedef struct {
+  unsigned generation; // the generation the cached blocks belong to
+  int registered;      // whether the thread exit flush is set up
+  unsigned count[NUM_SMALL_CLASSES];
+  header_t *head[NUM_SMALL_CLASSES]; // linked through next
+} cache_t;
+
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static __thread cache_t cache;
+#endif
+
+#ifdef SLABS
+enum {
+  RUN_BYTES = 4096, // a page
+  SLAB_STEP = 8,
+  NUM_SLAB_CLASSES = 8,
+  MAX_SLAB_BYTES = SLAB_STEP * NUM_SLAB_CLASSES,
+  RUN_WORDS = RUN_BYTES / SLAB_STEP / 32 // enough for the most slots a run can have
+};
+
+// the start of a run, followed by its slots
+typedef struct run {
+  struct run *prev;
+  struct run *next;
+  unsigned bytes; // of each slot, 0 for a run with none in use
+  unsigned free;  // slots free
+  unsigned map[RUN_WORDS]; // bit k is set iff slot k is free
+} run_t;
+
+static int slab_arena; // the memlib arena of the runs, or -1 if there is none
+static run_t *runs[NUM_SLAB_CLASSES]; // runs with a free slot, by slot size
+static run_t *spare_runs; // runs with no slot in use
+#endif
 
 static size_t bytes_to_units(size_t);
+static size_t get_payload_bytes(size_t);
 static int get_class_index(size_t);
 static size_t get_total_units(header_t *);
 static header_t *get_header(void *);
+static header_t *get_sized_header(void *, size_t);
 static unit_t *get_payload(header_t *);
 static header_t *get_next_in_heap(header_t *);
 static header_t *get_prev_in_heap(header_t *);
 inline static footer_t *get_footer(header_t *);
 inline static int is_footer_valid(header_t *);
 static void set_footer(header_t *);
+static void set_alloc(header_t *, unsigned);
+static void insert_tree(header_t *);
+static void remove_tree(header_t *);
+static header_t *find_tree(size_t);
+static header_t *find_list(int, size_t);
 static void free_block(header_t *);
+static void coalesce_block(header_t *);
+static void merge_block(header_t *);
+static void free_heap_block(header_t *);
+#ifndef THREADS
+static void free_batch(void **, size_t);
+#ifdef DEFERRED_COALESCE
+static void splice_chains(header_t **, header_t **);
+#endif
+#endif
+#ifdef TRIM
+static int trim_block(header_t *);
+#endif
+#ifdef DEFERRED_COALESCE
+static int coalesce_heap(void);
+#endif
 static unit_t *allocate(size_t);
 static unit_t *allocate_from_larger(int, size_t);
 static unit_t *allocate_largish(int, size_t);
 static unit_t *allocate_block(header_t *);
 inline static unit_t *split_block(header_t *, size_t);
+static void shrink_block(header_t *, size_t);
+static unit_t *allocate_aligned(size_t, size_t);
 static unit_t *allocate_next(size_t);
+static size_t allocate_batch(size_t, void **, size_t);
+static size_t allocate_next_batch(size_t, void **, size_t);
 static int grow_heap(size_t);
+static void init_arena(arena_t *, int);
+#ifdef STATS
+static unsigned long count_tree(tree_t *);
+static void add_stats(mm_stats_t *, arena_t *);
+#endif
+static void walk_arena(arena_t *, mm_walk_t, void *);
+static void *reallocate(void *, size_t);
+static void zero_payload(void *, size_t);
+inline static size_t get_slack(size_t);
+#ifdef ARENAS
+static void make_arena_key(void);
+static void detach_arena(void *);
+inline static arena_t *get_arena(void);
+static arena_t *attach_arena(void);
+static void drain_remote(void);
+inline static void free_remote(arena_t *, header_t *);
+static arena_t *fall_back(void);
+static void come_back(arena_t *);
+#endif
+#ifdef THREADS
+static void make_cache_key(void);
+static void flush_cache(void *);
+inline static cache_t *get_cache(void);
+static unit_t *cached_allocate(size_t);
+static void cached_free(header_t *);
+#endif
+#ifdef SLABS
+static void init_slabs(void);
+static void walk_slabs(mm_walk_t, void *);
+inline static int is_slot(void *);
+inline static unsigned get_slots(unsigned);
+inline static run_t *get_run(void *);
+static void push_run(run_t *, run_t **);
+static void pop_run(run_t *, run_t **);
+static run_t *new_run(int);
+static void *slab_allocate(size_t);
+static void slab_free(void *);
+#endif
+#ifdef MMAP
+inline static int is_mapped(void *);
+static void *map_allocate(size_t);
+static void map_free(void *);
+static void *map_reallocate(void *, size_t);
+#endif
 
 /*
  * bytes_to_units - converts bytes to units - 1 by taking the ceiling of bytes / UNIT_BYTES - 1
  */
 inline static size_t bytes_to_units(const size_t bytes) {
   assert(bytes);
-  return bytes / sizeof(unit_t) - (bytes % sizeof(unit_t) == 0);
+  const size_t units = bytes / sizeof(unit_t) - (bytes % sizeof(unit_t) == 0);
+#ifdef ELIDE_FOOTERS
+  // the footer is payload too, but the block still has to be big enough to free
+  return units ? units - 1 : 0;
+#else
+  return units;
+#endif
+}
+
+/*
+ * get_payload_bytes - gets how many bytes an allocated block of units of payload - 1 can hold
+ */
+inline static size_t get_payload_bytes(const size_t units) {
+#ifdef ELIDE_FOOTERS
+  return (units + 2) * sizeof(unit_t);
+#else
+  return (units + 1) * sizeof(unit_t);
+#endif
 }
 
 /*
  * get_class_index - gets the index of the class that corresponds to units of payload - 1
+ *  each medium class covers a power of 2 of the payload units an allocated block holds,
+ *  starting at 8-15, unless the classes come from the table
  */
 inline static int get_class_index(const size_t units) {
-  switch (units) {
-  case 0 ... 6:
-    return units;
-  case 7 ... 14:
-    return 7;
-  case 15 ... 30:
-    return 8;
-  case 31 ... 62:
-    return 9;
-  default:
-    return 10;
-  }
+#ifdef CLASS_TABLE
+  const size_t payload = get_payload_bytes(units) / sizeof(unit_t);
+  return payload < CLASS_TABLE_UNITS ? class_table[payload] : LARGE_CLASS;
+#else
+  const unsigned payload = get_payload_bytes(units) / sizeof(unit_t);
+  const int medium = NUM_SMALL_CLASSES - __builtin_ctz(NUM_SMALL_CLASSES + 1) + (31 - __builtin_clz(payload));
+  const int largish = medium < LARGE_CLASS ? medium : LARGE_CLASS;
+  return medium < NUM_SMALL_CLASSES ? (int)units : largish;
+#endif
 }
 
 /*
@@ -163,12 +555,19 @@ inline static header_t *get_next_in_heap(header_t *const block) {
 
 /*
  * get_prev_in_heap - get the block immediately before a given block in the heap
+ *  returns NULL for the first block, with ELIDE_FOOTERS for an allocated one,
+ *  and without footers for every one.
  */
 inline static header_t *get_prev_in_heap(header_t *const block) {
-  assert(block >= (header_t *)mem_heap_lo());
+  assert((unit_t *)block >= arena->lo);
   assert(is_footer_valid(block));
-  if (block == mem_heap_lo())
+  if ((unit_t *)block == arena->lo || FOOTERS == FOOTERS_NONE)
     return NULL;
+#ifdef ELIDE_FOOTERS
+  // an allocated block has no footer to find its header by
+  if (block->prev_alloc)
+    return NULL;
+#endif
   return (header_t *)((unit_t*)block - MIN_BLOCK_UNITS - ((footer_t *)block - 1)->size);
 }
 
@@ -177,14 +576,32 @@ inline static header_t *get_prev_in_heap(header_t *const block) {
  */
 inline static header_t *get_header(void *const payload) {
   header_t *const header = (header_t *)((unit_t *)payload - 1);
+#ifdef DEBUG
   if (!is_footer_valid(header)) {
     fprintf(stderr, "%p is not a valid block\n", payload);
-#ifdef DEBUG
     fprintf(stderr,
 	    "size according to header: %u\n"
 	    "size according to footer: %u\n",
 	    header->size, get_footer(header)->size);
+    abort();
+  }
 #endif
+  if (!header->alloc) {
+    fprintf(stderr, "%p is the payload of an already freed block\n", payload);
+    abort();
+  }
+  return header;
+}
+
+/*
+ * get_sized_header - gets the header of a payload the caller says holds bytes,
+ *  which checks them against the header's size instead of the footer against the header,
+ *  so that freeing touches only the header's cache line
+ */
+inline static header_t *get_sized_header(void *const payload, const size_t bytes) {
+  header_t *const header = (header_t *)((unit_t *)payload - 1);
+  if (bytes > get_payload_bytes(header->size)) {
+    fprintf(stderr, "%p is not a valid block of %u bytes\n", payload, (unsigned)bytes);
     abort();
   }
   if (!header->alloc) {
@@ -214,6 +631,13 @@ inline static footer_t *get_footer(header_t *const block) {
  * is_footer_valid - checks whether a footer is valid
  */
 inline static int is_footer_valid(header_t *const header) {
+#if FOOTERS == FOOTERS_NONE
+  return 1;
+#endif
+#ifdef ELIDE_FOOTERS
+  if (header->alloc)
+    return 1;
+#endif
   return !memcmp(get_footer(header), header, sizeof(footer_t));
 }
 
@@ -221,39 +645,420 @@ inline static int is_footer_valid(header_t *const header) {
  * set_footer - sets a block's footer
  */
 inline static void set_footer(header_t *const block) {
+#if FOOTERS == FOOTERS_NONE
+  return;
+#endif
+#ifdef ELIDE_FOOTERS
+  // the footer of an allocated block is its payload
+  if (block->alloc)
+    return;
+#endif
   *get_footer(block) = *(footer_t *)block;
 }
 
+/*
+ * set_alloc - marks a block allocated or free, and with ELIDE_FOOTERS,
+ *  tells the block after it, which keeps its own footer in sync
+ */
+inline static void set_alloc(header_t *const block, const unsigned alloc) {
+  block->alloc = alloc;
+#ifdef ELIDE_FOOTERS
+  header_t *const right = (header_t *)((unit_t *)block + MIN_BLOCK_UNITS + block->size);
+  if ((unit_t *)right == arena->next) {
+    arena->last_alloc = alloc;
+    return;
+  }
+  right->prev_alloc = alloc;
+  set_footer(right);
+#endif
+}
+
+/*
+ * insert_tree - adds a free block to the large class's trie.
+ */
+static void insert_tree(header_t *const block) {
+  assert(block->i == LARGE_CLASS);
+
+  tree_t *const node = (tree_t *)block;
+  tree_t **link = (tree_t **)&arena->classes[LARGE_CLASS].head;
+  tree_t *parent = NULL;
+  int bit;
+  for (bit = SIZE_BITS - 1; *link != NULL; bit--) {
+    tree_t *const t = *link;
+
+    // a block of a size already in the trie is chained after its node
+    if (t->header.size == block->size) {
+      block->prev = &t->header;
+      block->next = t->header.next;
+      if (t->header.next != NULL)
+	t->header.next->prev = block;
+      t->header.next = block;
+      return;
+    }
+
+    // every bit is used up only where the sizes are equal
+    assert(bit >= 0);
+    parent = t;
+    link = &t->child[(block->size >> bit) & 1];
+  }
+
+  block->prev = block->next = NULL;
+  node->child[0] = node->child[1] = NULL;
+  node->parent = parent;
+  *link = node;
+}
+
+/*
+ * remove_tree - removes a free block from the large class's trie.
+ */
+static void remove_tree(header_t *const block) {
+  assert(block->i == LARGE_CLASS);
+
+  // a chained block is just unlinked
+  if (block->prev != NULL) {
+    block->prev->next = block->next;
+    if (block->next != NULL)
+      block->next->prev = block->prev;
+    return;
+  }
+
+  tree_t *const node = (tree_t *)block;
+  tree_t *replacement;
+  if (block->next != NULL) {
+    // the next block of the same size takes over the node
+    replacement = (tree_t *)block->next;
+    replacement->header.prev = NULL;
+  } else {
+    // any leaf below the node shares its prefix, so it can take its place
+    for (replacement = node;
+	 replacement->child[0] != NULL || replacement->child[1] != NULL;
+	 replacement = replacement->child[replacement->child[1] != NULL]);
+    if (replacement == node)
+      replacement = NULL;
+    else
+      replacement->parent->child[replacement->parent->child[1] == replacement] = NULL;
+  }
+
+  if (replacement != NULL) {
+    int k;
+    for (k = 0; k < 2; k++) {
+      replacement->child[k] = node->child[k];
+      if (node->child[k] != NULL)
+	node->child[k]->parent = replacement;
+    }
+    replacement->parent = node->parent;
+  }
+
+  if (node->parent == NULL)
+    arena->classes[LARGE_CLASS].head = replacement != NULL ? &replacement->header : NULL;
+  else
+    node->parent->child[node->parent->child[1] == node] = replacement;
+}
+
+/*
+ * find_tree - finds the smallest free block in the trie with a payload of at least units - 1.
+ *  returns NULL if there is none.
+ */
+static header_t *find_tree(const size_t units) {
+  tree_t *best = NULL;
+  // the deepest subtree passed up whose sizes are all larger than units
+  tree_t *larger = NULL;
+
+  tree_t *t = (tree_t *)arena->classes[LARGE_CLASS].head;
+  int bit;
+  for (bit = SIZE_BITS - 1; t != NULL; bit--) {
+    tally(fit_steps, 1);
+    if (t->header.size >= units
+	&& (best == NULL || t->header.size < best->header.size)) {
+      best = t;
+      if (t->header.size == units)
+	break;
+    }
+    if (bit < 0)
+      break;
+
+    const int dir = (units >> bit) & 1;
+    if (!dir && t->child[1] != NULL)
+      larger = t->child[1];
+    t = t->child[dir];
+  }
+
+  // the smallest size in a subtree is its root or below its leftmost child
+  if (best == NULL || best->header.size != units)
+    for (t = larger; t != NULL; t = t->child[t->child[0] == NULL]) {
+      tally(fit_steps, 1);
+      if (best == NULL || t->header.size < best->header.size)
+	best = t;
+    }
+
+  if (best == NULL)
+    return NULL;
+  // prefer a chained block, which is cheaper to remove
+  return best->header.next != NULL ? best->header.next : &best->header;
+}
+
 /*
  * free_block - frees a block and adds it to its free list.
  */
 inline static void free_block(header_t *const block) {
   assert(block != NULL); 
   assert(block->alloc);
-  block->alloc = 0; 
+  set_alloc(block, 0);
   block->i = get_class_index(block->size); 
-  if (classes[block->i].head == NULL) { 
-    classes[block->i].head = block;
+  arena->nonempty |= 1u << block->i;
+#ifdef DEFERRED_COALESCE
+  // quick lists hand out the most recently freed block first
+  if (block->i < NUM_SMALL_CLASSES && arena->classes[block->i].head != NULL) {
+    arena->classes[block->i].head->prev = block;
+    block->next = arena->classes[block->i].head;
+    block->prev = NULL;
+    arena->classes[block->i].head = block;
+    set_footer(block);
+    return;
+  }
+#endif
+  if (block->i == LARGE_CLASS) {
+    insert_tree(block);
+    set_footer(block);
+    return;
+  }
+  if (arena->classes[block->i].head == NULL) { 
+    arena->classes[block->i].head = block;
     block->prev = NULL; 
   } else {
-    classes[block->i].last->next = block;
-    block->prev = classes[block->i].last;
+    arena->classes[block->i].last->next = block;
+    block->prev = arena->classes[block->i].last;
   }
   block->next = NULL;
-  classes[block->i].last = block;
+  arena->classes[block->i].last = block;
   set_footer(block);
 }
 
+/*
+ * coalesce_block - frees a block after merging it with its free neighbours in the heap.
+ *  the merged block is added to the free list of its new class.
+ */
+static void coalesce_block(header_t *block) {
+  assert(block != NULL);
+  assert(block->alloc);
+
+#ifdef DEFERRED_COALESCE
+  // small blocks wait on their quick list for the next sweep
+  if (get_class_index(block->size) < NUM_SMALL_CLASSES) {
+    arena->deferred++;
+    free_block(block);
+    return;
+  }
+#endif
+
+  merge_block(block);
+}
+
+/*
+ * merge_block - frees a block after merging it with its free neighbours in the heap
+ *  if there is coalescing at all, never deferring it.
+ */
+static void merge_block(header_t *block) {
+  assert(block->alloc);
+
+#ifdef COALESCE_ON_FREE
+  size_t size = block->size;
+
+  header_t *const right = get_next_in_heap(block);
+  if ((unit_t *)right < arena->next && !right->alloc) {
+    allocate_block(right);
+    size += get_total_units(right);
+    tally(coalesces, 1);
+  }
+
+  header_t *const left = get_prev_in_heap(block);
+  if (left != NULL && !left->alloc) {
+    allocate_block(left);
+    size += get_total_units(left);
+    block = left;
+    tally(coalesces, 1);
+  }
+
+  block->size = size;
+#ifdef TRIM
+  if (trim_block(block))
+    return;
+#endif
+#endif
+
+  free_block(block);
+}
+
+#ifndef THREADS
+/*
+ * free_batch - frees the blocks of payloads, which may be slots, mappings or NULL.
+ *  with DEFERRED_COALESCE, the small blocks are chained by class, and the chains
+ *  are spliced onto their quick lists before anything is coalesced and at the end,
+ *  so coalescing never comes across a free block that is in no list.
+ */
+static void free_batch(void **const payloads, const size_t n) {
+#ifdef DEFERRED_COALESCE
+  header_t *head[NUM_SMALL_CLASSES];
+  header_t *last[NUM_SMALL_CLASSES];
+  // a class table may have no small classes at all
+  memset(head, 0, sizeof(head));
+#endif
+  size_t k;
+  for (k = 0; k < n; k++) {
+    void *const ptr = payloads[k];
+    if (ptr == NULL)
+      continue;
+#ifdef SLABS
+    if (is_slot(ptr)) {
+      slab_free(ptr);
+      continue;
+    }
+#endif
+#ifdef MMAP
+    if (is_mapped(ptr)) {
+      map_free(ptr);
+      continue;
+    }
+#endif
+
+    header_t *const block = get_header(ptr);
+#ifdef ARENAS
+    arena_t *const owner = &arenas[mem_arena_of(block)];
+    if (owner != arena) {
+      free_remote(owner, block);
+      continue;
+    }
+#endif
+#ifdef DEFERRED_COALESCE
+    const int i = get_class_index(block->size);
+    if (i < NUM_SMALL_CLASSES) {
+      set_alloc(block, 0);
+      block->i = i;
+      block->prev = NULL;
+      block->next = head[i];
+      if (head[i] != NULL)
+	head[i]->prev = block;
+      else
+	last[i] = block;
+      head[i] = block;
+      set_footer(block);
+      arena->deferred++;
+      continue;
+    }
+    splice_chains(head, last);
+#endif
+    coalesce_block(block);
+  }
+#ifdef DEFERRED_COALESCE
+  splice_chains(head, last);
+#endif
+}
+
+#ifdef DEFERRED_COALESCE
+/*
+ * splice_chains - puts chains of free small blocks at the heads of their quick lists,
+ *  leaving the chains empty.
+ */
+static void splice_chains(header_t **const head, header_t **const last) {
+  int i;
+  for (i = 0; i < NUM_SMALL_CLASSES; i++) {
+    if (head[i] == NULL)
+      continue;
+    if (arena->classes[i].head == NULL)
+      arena->classes[i].last = last[i];
+    else {
+      last[i]->next = arena->classes[i].head;
+      arena->classes[i].head->prev = last[i];
+    }
+    arena->classes[i].head = head[i];
+    arena->nonempty |= 1u << i;
+    head[i] = NULL;
+  }
+}
+#endif
+#endif
+
+#ifdef TRIM
+/*
+ * trim_block - gives back a merged block that is about to be freed, if it is at least TRIM_BYTES.
+ *  the heap shrinks if the block ends it, otherwise the pages inside it are released.
+ *  returns whether the heap shrank, in which case the block is gone.
+ */
+static int trim_block(header_t *const block) {
+  assert(block->alloc);
+  const size_t units = MIN_BLOCK_UNITS + block->size;
+  if (units * sizeof(unit_t) < TRIM_BYTES)
+    return 0;
+
+  if ((unit_t *)block + units != arena->next) {
+    // only the links of a trie node and the footer have to survive
+    mem_release((tree_t *)block + 1, (units - 1) * sizeof(unit_t) - sizeof(tree_t));
+    return 0;
+  }
+
+  int64_t bytes;
+  for (bytes = units * (int64_t)sizeof(unit_t); bytes >= INT_MAX; bytes -= INT_MAX)
+    mem_arena_sbrk(arena->index, -INT_MAX);
+  if (bytes)
+    mem_arena_sbrk(arena->index, -bytes);
+  arena->next = (unit_t *)block;
+#ifdef ELIDE_FOOTERS
+  arena->last_alloc = block->prev_alloc;
+#endif
+  return 1;
+}
+#endif
+
+#ifdef DEFERRED_COALESCE
+/*
+ * coalesce_heap - merges every run of adjacent free blocks in the heap.
+ *  returns whether any blocks were merged.
+ */
+static int coalesce_heap(void) {
+  int merged = 0;
+
+  header_t *block;
+  for (block = (header_t *)arena->lo; (unit_t *)block < arena->next; block = get_next_in_heap(block)) {
+    if (block->alloc)
+      continue;
+
+    header_t *right = get_next_in_heap(block);
+    if ((unit_t *)right == arena->next || right->alloc)
+      continue;
+
+    allocate_block(block);
+    size_t size = block->size;
+    do {
+      allocate_block(right);
+      size += get_total_units(right);
+      right = get_next_in_heap(right);
+      tally(coalesces, 1);
+    } while ((unit_t *)right < arena->next && !right->alloc);
+
+    block->size = size;
+    merged = 1;
+#ifdef TRIM
+    if (trim_block(block))
+      break; // the heap ended with the run
+#endif
+    free_block(block);
+  }
+
+  arena->deferred = 0;
+  return merged;
+}
+#endif
+
 /*
  * allocate - allocates a block of a payload size in units
  */
 inline static unit_t *allocate(const size_t units) {
   const int i = get_class_index(units);
 
-  if (classes[i].head != NULL) {
+  if (arena->classes[i].head != NULL) {
     // for a small class, go straight to allocating the head
     if (i < NUM_SMALL_CLASSES)
-      return allocate_block(classes[i].head);
+      return allocate_block(arena->classes[i].head);
 
     // for a medium or large class, find a free block that fits, then split it   
     return allocate_largish(i, units);
@@ -268,26 +1073,40 @@ inline static unit_t *allocate(const size_t units) {
  */
 static unit_t *allocate_from_larger(const int i, const size_t units) {
   assert(i == get_class_index(units));
+  tally(escalations, 1);
 
-  int j;
-  for (j = i + 1; j < NUM_CLASSES && classes[j].head == NULL; j++);
+  const unsigned larger = arena->nonempty & (~0u << (i + 1));
 
   // if none of the classes have any free blocks, try to grab from the end of the heap
-  if (j == NUM_CLASSES)
+  if (larger == 0) {
+#ifdef DEFERRED_COALESCE
+    // but first see if sweeping the quick lists makes a fit
+    if (arena->deferred && coalesce_heap())
+      return allocate(units);
+#endif
     return allocate_next(units);
-  // otherwise, use its head
-  return split_block(classes[j].head, units);
+  }
+  // otherwise, use the head of the next one, or the best fit of the trie
+  const int j = __builtin_ctz(larger);
+  assert(arena->classes[j].head != NULL);
+  if (j == LARGE_CLASS)
+    return split_block(find_tree(units), units);
+  return split_block(arena->classes[j].head, units);
 }
 
 /*
  * allocate_largish - allocate a "largish" (medium or large) block.
+ *  a medium block is picked from its list by FIT, a large block is the best fit in the trie.
  */
 static unit_t *allocate_largish(const int i, const size_t units) {
   assert(i == get_class_index(units));
-  assert(classes[i].head != NULL);
+  assert(arena->classes[i].head != NULL);
 
   header_t *block;
-  for (block = classes[i].head; block != NULL && block->size < units; block = block->next);
+  if (i == LARGE_CLASS)
+    block = find_tree(units);
+  else
+    block = find_list(i, units);
 
   // if no fitting block exists, allocate from larger sources
   if (block == NULL)
@@ -297,6 +1116,44 @@ static unit_t *allocate_largish(const int i, const size_t units) {
 }
 
 
+/*
+ * find_list - finds a block of a medium class that fits units of payload - 1, as FIT says
+ *  returns NULL if none does.
+ */
+inline static header_t *find_list(const int i, const size_t units) {
+  header_t *block;
+#if FIT == FIT_BEST
+  header_t *best = NULL;
+  for (block = arena->classes[i].head; block != NULL; block = block->next) {
+    tally(fit_steps, 1);
+    if (block->size >= units && (best == NULL || block->size < best->size)) {
+      best = block;
+      if (best->size == units)
+	break;
+    }
+  }
+  return best;
+#elif FIT == FIT_NEXT
+  // go on from the rover to the end, then from the head up to the rover
+  header_t *const rover = arena->rover[i] != NULL ? arena->rover[i] : arena->classes[i].head;
+  for (block = rover; block != NULL; block = block->next) {
+    tally(fit_steps, 1);
+    if (block->size >= units)
+      return arena->rover[i] = block;
+  }
+  for (block = arena->classes[i].head; block != rover; block = block->next) {
+    tally(fit_steps, 1);
+    if (block->size >= units)
+      return arena->rover[i] = block;
+  }
+  return NULL;
+#else
+  for (block = arena->classes[i].head; block != NULL && block->size < units; block = block->next)
+    tally(fit_steps, 1);
+  return block;
+#endif
+}
+
 /*
  * allocate_block - allocates a block and removes it from its free list
  */
@@ -304,27 +1161,43 @@ static unit_t *allocate_block(header_t *const block) {
   assert(block != NULL);
   assert(!block->alloc);
   assert(block->i == get_class_index(block->size));
-  aprintf((block->prev == NULL) == (classes[block->i].head == block),
+
+  set_alloc(block, 1);
+
+  if (block->i == LARGE_CLASS) {
+    remove_tree(block);
+    if (arena->classes[LARGE_CLASS].head == NULL)
+      arena->nonempty &= ~(1u << LARGE_CLASS);
+    set_footer(block);
+    return get_payload(block);
+  }
+
+  aprintf((block->prev == NULL) == (arena->classes[block->i].head == block),
 	  "block == %p\n"
 	  "block->prev == %p\n"
 	  "block->i == %d\n"
 	  "classes[block->i].head == %p\n",
-	  block, block->prev, block->i, classes[block->i].head);
-  assert((block->next == NULL) == (classes[block->i].last == block));
-
-  block->alloc = 1;
+	  block, block->prev, block->i, arena->classes[block->i].head);
+  assert((block->next == NULL) == (arena->classes[block->i].last == block));
 
   const int isHead = block->prev == NULL;//classes[i].head == block;
   const int isLast = block->next == NULL;//classes[i].last == block;
 
+#if FIT == FIT_NEXT
+  // the next search starts after the block instead
+  if (arena->rover[block->i] == block)
+    arena->rover[block->i] = block->next;
+#endif
+
   // special casing
   if (isHead && isLast) {
-    classes[block->i].head = classes[block->i].last = NULL;
+    arena->classes[block->i].head = arena->classes[block->i].last = NULL;
+    arena->nonempty &= ~(1u << block->i);
   } else if (isHead) {
-    classes[block->i].head = block->next;
+    arena->classes[block->i].head = block->next;
     block->next->prev = NULL;
   } else if (isLast) {
-    classes[block->i].last = block->prev;
+    arena->classes[block->i].last = block->prev;
     block->prev->next = NULL;
   } else {
     block->prev->next = block->next;
@@ -357,10 +1230,12 @@ inline static unit_t *split_block(header_t *const left, const size_t left_size)
   // change the size accordingly
   left->size = left_size;
   set_footer(left);
+  tally(splits, 1);
   
   header_t *const right = get_next_in_heap(left);
   // -1 for the header, -1 for how units is defined, -1 for the footer
   right->size = remaining - MIN_BLOCK_UNITS;
+  right->prev_alloc = 1;
   right->alloc = 1;
   free_block(right);
 
@@ -368,23 +1243,161 @@ inline static unit_t *split_block(header_t *const left, const size_t left_size)
 }
 
 /*
- * allocate_next - attempts to allocate the next block in the entire heap.
- *  returns NULL if the heap needs to grow but cannot.
+ * shrink_block - splits the end off an allocated block, down to units of payload - 1,
+ *  and frees it, merged at once even if coalescing is deferred, as it rarely fits a request.
+ *  does NOT split if there is not enough left for a right block.
  */
-static unit_t *allocate_next(const size_t units) {
-  header_t *const block = (header_t *)next;
+static void shrink_block(header_t *const block, const size_t units) {
+  assert(block->alloc);
+  assert(units <= block->size);
+
+  const size_t remaining = block->size - units;
+  if (remaining < MIN_BLOCK_UNITS)
+    return;
 
-  // +1 for header, +1 for first payload unit, +1 for the footer
-  if (grow_heap(MIN_BLOCK_UNITS + units) < 0)
-    return NULL;
- 
   block->size = units;
-  block->alloc = 1;
   set_footer(block);
+  tally(splits, 1);
+
+  header_t *const right = get_next_in_heap(block);
+  right->size = remaining - MIN_BLOCK_UNITS;
+  right->prev_alloc = 1;
+  right->alloc = 1;
+  set_footer(right);
+  merge_block(right);
+}
+
+/*
+ * allocate_aligned - allocates a block of a payload size in units whose payload is
+ *  a multiple of alignment bytes, a power of 2.
+ *  the block found is padded so that an aligned payload at least a block into it fits,
+ *  and the padding before it is freed as a block of its own.
+ *  returns the payload or NULL on heap failure.
+ */
+static unit_t *allocate_aligned(const size_t alignment, const size_t units) {
+  // every payload in the heap is a unit apart from the next
+  if (alignment <= sizeof(unit_t))
+    return allocate(units);
+
+  const size_t padded = units + MIN_BLOCK_UNITS + alignment / sizeof(unit_t) - 1;
+  if (padded >= (size_t)1 << SIZE_BITS)
+    return NULL;
+  // the padding is slack, so rather than search a medium class for a block that holds it all,
+  // take the head of a larger one, if any
+  const int i = get_class_index(padded);
+  unit_t *const payload = i >= NUM_SMALL_CLASSES && i < LARGE_CLASS ?
+    allocate_from_larger(i, padded) :
+    allocate(padded);
+  if (payload == NULL)
+    return NULL;
+  header_t *block = (header_t *)(payload - 1);
+
+  unit_t *aligned = (unit_t *)(((uintptr_t)payload + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  if (aligned != payload && aligned - payload < MIN_BLOCK_UNITS)
+    aligned += alignment / sizeof(unit_t);
+  if (aligned != payload) {
+    const size_t lead = aligned - payload;
+    // the new header goes first, since freeing the padding marks the block after it
+    header_t *const right = (header_t *)(aligned - 1);
+    right->size = block->size - lead;
+    right->prev_alloc = 1;
+    right->alloc = 1;
+    set_footer(right);
+
+    block->size = lead - MIN_BLOCK_UNITS;
+    set_footer(block);
+    tally(splits, 1);
+    merge_block(block);
+    block = right;
+  }
+
+  shrink_block(block, units);
+  return aligned;
+}
+
+/*
+ * allocate_next - attempts to allocate the next block in the entire heap.
+ *  returns NULL if the heap needs to grow but cannot.
+ */
+static unit_t *allocate_next(const size_t units) {
+  header_t *const block = (header_t *)arena->next;
+
+  // +1 for header, +1 for first payload unit, +1 for the footer
+  if (grow_heap(MIN_BLOCK_UNITS + units) < 0)
+    return NULL;
+ 
+  block->size = units;
+#ifdef ELIDE_FOOTERS
+  block->prev_alloc = arena->last_alloc;
+#endif
+  set_alloc(block, 1);
+  set_footer(block);
+
+  return get_payload(block);
+}
+
+/*
+ * allocate_batch - allocates n blocks of a payload size in units into payloads.
+ *  a small class hands out the blocks of its list first, and once no class as large
+ *  has a free block, the rest are carved from the end of the heap together.
+ *  returns how many were allocated, fewer than n on heap failure.
+ */
+static size_t allocate_batch(const size_t units, void **const payloads, const size_t n) {
+  const int i = get_class_index(units);
+  size_t k = 0;
+
+  if (i < NUM_SMALL_CLASSES)
+    while (k < n && arena->classes[i].head != NULL)
+      payloads[k++] = allocate_block(arena->classes[i].head);
+
+  while (k < n) {
+    if ((arena->nonempty & ~0u << i) == 0) {
+#ifdef DEFERRED_COALESCE
+      // a sweep may make a fit, as in allocate_from_larger
+      if (arena->deferred && coalesce_heap())
+	continue;
+#endif
+      return k + allocate_next_batch(units, payloads + k, n - k);
+    }
+    if ((payloads[k] = allocate(units)) == NULL)
+      return k;
+    k++;
+  }
+  return k;
+}
+
+/*
+ * allocate_next_batch - allocates n blocks at the end of the heap, growing it once.
+ *  if the heap cannot grow by all of them, it grows by one block at a time.
+ *  returns how many were allocated.
+ */
+static size_t allocate_next_batch(const size_t units, void **const payloads, const size_t n) {
+  const size_t total = MIN_BLOCK_UNITS + units;
+  header_t *block = (header_t *)arena->next;
+  size_t k;
+
+  if (n > SIZE_MAX / total || grow_heap(n * total) < 0) {
+    for (k = 0; k < n && (payloads[k] = allocate_next(units)) != NULL; k++);
+    return k;
+  }
+
+  for (k = 0; k < n; k++) {
+    block->size = units;
+#ifdef ELIDE_FOOTERS
+    block->prev_alloc = k ? 1 : arena->last_alloc;
+#endif
+    // set_alloc would look at the block after it, which isn't set up yet
+    block->alloc = 1;
+    set_footer(block);
+    payloads[k] = get_payload(block);
+    block = (header_t *)((unit_t *)block + total);
+  }
+#ifdef ELIDE_FOOTERS
+  arena->last_alloc = 1;
+#endif
+  return n;
+}
 
-  return get_payload(block);
-}
-
 /*
  * grow_heap - grows the heap in units
  *  returns 0 on success, -1 on failure
@@ -392,33 +1405,591 @@ static unit_t *allocate_next(const size_t units) {
 static int grow_heap(const size_t units) {
   assert(units);
   
-  const size_t prev_heapsize = mem_heapsize();
+  const size_t prev_heapsize = mem_arena_heapsize(arena->index);
   int64_t bytes;
   for (bytes = units * (int64_t)sizeof(unit_t); bytes >= INT_MAX; bytes -= INT_MAX)
-    if (mem_sbrk(INT_MAX) == (void *)-1)
+    if (mem_arena_sbrk(arena->index, INT_MAX) == (void *)-1)
       goto heapfail;
-  if (bytes && mem_sbrk(bytes) == (void *)-1)
+  if (bytes && mem_arena_sbrk(arena->index, bytes) == (void *)-1)
     goto heapfail;
 
-  next += units;
+  arena->next += units;
+  tally(grows, 1);
+  tally(grow_bytes, units * sizeof(unit_t));
   
   return 0;
 
  heapfail:
-  mem_reset_brk();
-  mem_sbrk(prev_heapsize);
+  mem_arena_reset_brk(arena->index);
+  mem_arena_sbrk(arena->index, prev_heapsize);
   return -1;
 }
 
-/* 
- * mm_init - initialize the malloc package.
+/*
+ * init_arena - makes an arena with no blocks over a memlib arena
  */
-int mm_init(void) {
+static void init_arena(arena_t *const a, const int index) {
   int i;
   for (i = 0; i < NUM_CLASSES; i++)
-    classes[i].head = classes[i].last = NULL;
+    a->classes[i].head = a->classes[i].last = NULL;
+  a->nonempty = 0;
+#if FIT == FIT_NEXT
+  memset(a->rover, 0, sizeof(a->rover));
+#endif
+
+  a->index = index;
+  a->lo = a->next = mem_arena_lo(index);
+#ifdef ELIDE_FOOTERS
+  a->last_alloc = 1;
+#endif
+#ifdef DEFERRED_COALESCE
+  a->deferred = 0;
+#endif
+#if defined(THREADS) || defined(ARENAS)
+  pthread_mutex_init(&a->lock, NULL);
+#endif
+#ifdef ARENAS
+  a->threads = 0;
+  a->remote = NULL;
+#endif
+#ifdef STATS
+  memset(&a->stats, 0, sizeof(a->stats));
+#endif
+}
+
+#ifdef STATS
+/*
+ * count_tree - counts the free blocks in a trie, including those chained off its nodes
+ */
+static unsigned long count_tree(tree_t *const t) {
+  if (t == NULL)
+    return 0;
+
+  unsigned long n = 0;
+  header_t *block;
+  for (block = &t->header; block != NULL; block = block->next)
+    n++;
+  return n + count_tree(t->child[0]) + count_tree(t->child[1]);
+}
+
+/*
+ * add_stats - adds an arena's counters to stats, counting its free lists as well
+ */
+static void add_stats(mm_stats_t *const stats, arena_t *const a) {
+  int i;
+  for (i = 0; i < NUM_CLASSES; i++) {
+    if (i == LARGE_CLASS) {
+      stats->free_blocks[i] += count_tree((tree_t *)a->classes[i].head);
+      continue;
+    }
+    header_t *block;
+    for (block = a->classes[i].head; block != NULL; block = block->next)
+      stats->free_blocks[i]++;
+  }
+
+  stats->fit_steps += a->stats.fit_steps;
+  stats->escalations += a->stats.escalations;
+  stats->splits += a->stats.splits;
+  stats->coalesces += a->stats.coalesces;
+  stats->grows += a->stats.grows;
+  stats->grow_bytes += a->stats.grow_bytes;
+  stats->realloc_shrink += a->stats.realloc_shrink;
+  stats->realloc_right += a->stats.realloc_right;
+  stats->realloc_left += a->stats.realloc_left;
+  stats->realloc_grow += a->stats.realloc_grow;
+  stats->realloc_move += a->stats.realloc_move;
+}
+#endif
+
+/*
+ * walk_arena - calls walk on every block of an arena's heap, in address order
+ */
+static void walk_arena(arena_t *const a, const mm_walk_t walk, void *const arg) {
+  header_t *block;
+  for (block = (header_t *)a->lo; (unit_t *)block < a->next; block = get_next_in_heap(block)) {
+    const mm_block_t b = {
+      get_payload(block), get_payload_bytes(block->size), block->alloc, get_class_index(block->size)
+    };
+    walk(&b, arg);
+  }
+}
+
+#ifdef ARENAS
+/*
+ * free_remote - pushes a block of another arena for its owner to free,
+ *  which is lock-free since only the owner takes the list
+ */
+inline static void free_remote(arena_t *const owner, header_t *const block) {
+  do
+    block->next = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+  while (!__sync_bool_compare_and_swap(&owner->remote, block->next, block));
+}
+
+/*
+ * make_arena_key - creates the key whose destructor detaches a thread from its arena when it exits
+ */
+static void make_arena_key(void) {
+  pthread_key_create(&arena_key, detach_arena);
+}
+
+/*
+ * detach_arena - lets another thread take over an exiting thread's arena
+ */
+static void detach_arena(void *const arg) {
+  arena_t *const a = arg;
+
+  pthread_mutex_lock(&arenas_lock);
+  if (arena_generation == generation)
+    a->threads--;
+  pthread_mutex_unlock(&arenas_lock);
+}
+
+/*
+ * get_arena - gets the calling thread's arena, attaching it to one on its first call after mm_init
+ */
+inline static arena_t *get_arena(void) {
+  if (arena == NULL || arena_generation != generation)
+    arena = attach_arena();
+  return arena;
+}
+
+/*
+ * attach_arena - picks an arena for the calling thread.
+ *  an arena without threads is preferred, then a new arena,
+ *  then the arena with the fewest threads.
+ */
+static arena_t *attach_arena(void) {
+  pthread_once(&arena_once, make_arena_key);
+
+  pthread_mutex_lock(&arenas_lock);
+  arena_t *a = &arenas[0];
+  int k;
+  for (k = 1; k < num_arenas; k++)
+    if (arenas[k].threads < a->threads)
+      a = &arenas[k];
+
+  if (a->threads && num_arenas < MAX_ARENAS) {
+    // the heap must not grow while an arena is carved out of the top of it
+    pthread_mutex_lock(&arenas[0].lock);
+    const int index = mem_arena_new();
+    pthread_mutex_unlock(&arenas[0].lock);
+    if (index >= 0) {
+      assert(index == num_arenas);
+      a = &arenas[num_arenas++];
+      init_arena(a, index);
+    }
+  }
+  a->threads++;
+  pthread_mutex_unlock(&arenas_lock);
+
+  arena_generation = generation;
+  pthread_setspecific(arena_key, a);
+  return a;
+}
+
+/*
+ * drain_remote - frees the blocks that other threads have freed into the calling thread's arena
+ */
+static void drain_remote(void) {
+  if (__atomic_load_n(&arena->remote, __ATOMIC_RELAXED) == NULL)
+    return;
+
+  header_t *block = __sync_lock_test_and_set(&arena->remote, NULL);
+  while (block != NULL) {
+    header_t *const next_remote = block->next;
+    coalesce_block(block);
+    block = next_remote;
+  }
+}
+
+/*
+ * fall_back - moves the calling thread over to arena 0, the heap itself, and locks it
+ *  for a request its own arena has no room for, as a carved arena cannot grow past its slot.
+ *  returns the thread's own arena to come back to, or NULL if it is arena 0 already.
+ */
+static arena_t *fall_back(void) {
+  if (arena == &arenas[0])
+    return NULL;
+  arena_t *const own = arena;
+  arena = &arenas[0];
+  lock_heap();
+  drain_remote();
+  return own;
+}
+
+/*
+ * come_back - unlocks arena 0 and moves the calling thread back to its own arena
+ */
+static void come_back(arena_t *const own) {
+  unlock_heap();
+  arena = own;
+}
+#endif
+
+#ifdef THREADS
+/*
+ * make_cache_key - creates the key whose destructor flushes a thread's cache when it exits
+ */
+static void make_cache_key(void) {
+  pthread_key_create(&cache_key, flush_cache);
+}
+
+/*
+ * flush_cache - gives every block in a thread's cache back to the free lists
+ */
+static void flush_cache(void *const arg) {
+  cache_t *const c = arg;
+
+  lock_heap();
+  if (c->generation == generation) {
+    int i;
+    for (i = 0; i < NUM_SMALL_CLASSES; i++)
+      while (c->head[i] != NULL) {
+	header_t *const block = c->head[i];
+	c->head[i] = block->next;
+	coalesce_block(block);
+      }
+  }
+  unlock_heap();
+
+  memset(c->count, 0, sizeof(c->count));
+  memset(c->head, 0, sizeof(c->head));
+}
+
+/*
+ * get_cache - gets the calling thread's cache, emptied if it is from before the last mm_init
+ */
+inline static cache_t *get_cache(void) {
+  if (!cache.registered) {
+    pthread_once(&cache_once, make_cache_key);
+    pthread_setspecific(cache_key, &cache);
+    cache.registered = 1;
+  }
+
+  if (cache.generation != generation) {
+    cache.generation = generation;
+    memset(cache.count, 0, sizeof(cache.count));
+    memset(cache.head, 0, sizeof(cache.head));
+  }
+  return &cache;
+}
+
+/*
+ * cached_allocate - allocates a block, from the thread's cache if it is small.
+ *  an empty cache is refilled with a batch of the class's free blocks.
+ *  returns the payload or NULL on heap failure.
+ */
+static unit_t *cached_allocate(const size_t units) {
+  const int i = get_class_index(units);
+  if (i >= NUM_SMALL_CLASSES) {
+    lock_heap();
+    unit_t *const payload = allocate(units);
+    unlock_heap();
+    return payload;
+  }
+
+  cache_t *const c = get_cache();
+  header_t *const block = c->head[i];
+  if (block != NULL) {
+    c->head[i] = block->next;
+    c->count[i]--;
+    return get_payload(block);
+  }
+
+  lock_heap();
+  unit_t *const payload = allocate(units);
+  while (c->count[i] < CACHE_BATCH && arena->classes[i].head != NULL) {
+    header_t *const extra = arena->classes[i].head;
+    allocate_block(extra);
+    extra->next = c->head[i];
+    c->head[i] = extra;
+    c->count[i]++;
+  }
+  unlock_heap();
+
+  return payload;
+}
+
+/*
+ * cached_free - frees a block, into the thread's cache if it is small.
+ *  a full cache first flushes a batch of its blocks.
+ */
+static void cached_free(header_t *const block) {
+  const int i = get_class_index(block->size);
+  if (i >= NUM_SMALL_CLASSES) {
+    lock_heap();
+    coalesce_block(block);
+    unlock_heap();
+    return;
+  }
+
+  cache_t *const c = get_cache();
+  if (c->count[i] == CACHE_LIMIT) {
+    lock_heap();
+    for (; c->count[i] > CACHE_LIMIT - CACHE_BATCH; c->count[i]--) {
+      header_t *const old = c->head[i];
+      c->head[i] = old->next;
+      coalesce_block(old);
+    }
+    unlock_heap();
+  }
+
+  block->next = c->head[i];
+  c->head[i] = block;
+  c->count[i]++;
+}
+#endif
+
+#ifdef SLABS
+/*
+ * init_slabs - carves the arena for runs, if memlib has one to spare
+ */
+static void init_slabs(void) {
+  memset(runs, 0, sizeof(runs));
+  spare_runs = NULL;
+  slab_arena = mem_arena_new();
+}
+
+/*
+ * walk_slabs - calls walk on every slot of the runs, in address order,
+ *  where a run with none in use is a single free block.
+ *  slots are in no class.
+ */
+static void walk_slabs(const mm_walk_t walk, void *const arg) {
+  if (slab_arena <= 0)
+    return;
+
+  char *const lo = mem_arena_lo(slab_arena);
+  char *p;
+  for (p = lo; p < lo + mem_arena_heapsize(slab_arena); p += RUN_BYTES) {
+    run_t *const run = (run_t *)p;
+    if (run->bytes == 0) {
+      const mm_block_t b = {run + 1, RUN_BYTES - sizeof(run_t), 0, -1};
+      walk(&b, arg);
+      continue;
+    }
+    unsigned k;
+    for (k = 0; k < get_slots(run->bytes); k++) {
+      const mm_block_t b = {
+	(char *)(run + 1) + k * run->bytes, run->bytes, !(run->map[k / 32] & 1u << k % 32), -1
+      };
+      walk(&b, arg);
+    }
+  }
+}
+
+/*
+ * is_slot - checks whether a pointer is in the runs rather than the heap
+ */
+inline static int is_slot(void *const ptr) {
+  return slab_arena > 0 && mem_arena_of(ptr) == slab_arena;
+}
+
+/*
+ * get_slots - gets how many slots of a size fit in a run
+ */
+inline static unsigned get_slots(const unsigned bytes) {
+  return (RUN_BYTES - sizeof(run_t)) / bytes;
+}
+
+/*
+ * get_run - gets the run of a slot by masking its offset into the arena
+ */
+inline static run_t *get_run(void *const ptr) {
+  char *const lo = mem_arena_lo(slab_arena);
+  return (run_t *)(lo + (((char *)ptr - lo) & ~(size_t)(RUN_BYTES - 1)));
+}
+
+/*
+ * push_run - pushes a run onto the head of a list
+ */
+static void push_run(run_t *const run, run_t **const head) {
+  run->prev = NULL;
+  run->next = *head;
+  if (*head != NULL)
+    (*head)->prev = run;
+  *head = run;
+}
+
+/*
+ * pop_run - removes a run from a list
+ */
+static void pop_run(run_t *const run, run_t **const head) {
+  if (run->prev == NULL)
+    *head = run->next;
+  else
+    run->prev->next = run->next;
+  if (run->next != NULL)
+    run->next->prev = run->prev;
+}
+
+/*
+ * new_run - sets up a spare run, or one carved from the arena, for a slot size
+ *  returns NULL if the arena is full.
+ */
+static run_t *new_run(const int c) {
+  run_t *run = spare_runs;
+  if (run != NULL)
+    pop_run(run, &spare_runs);
+  else {
+    // the runs cannot fill more than the arena's slot
+    if (mem_arena_heapsize(slab_arena) + RUN_BYTES > mem_arena_bytes())
+      return NULL;
+    run = mem_arena_sbrk(slab_arena, RUN_BYTES);
+  }
+
+  run->bytes = (c + 1) * SLAB_STEP;
+  run->free = get_slots(run->bytes);
+  memset(run->map, 0, sizeof(run->map));
+  memset(run->map, 0xff, run->free / 32 * sizeof(*run->map));
+  if (run->free % 32)
+    run->map[run->free / 32] = (1u << run->free % 32) - 1;
+
+  push_run(run, &runs[c]);
+  return run;
+}
+
+/*
+ * slab_allocate - allocates a slot of the smallest size that fits
+ *  returns NULL if there is neither a free slot nor room for another run.
+ */
+static void *slab_allocate(const size_t bytes) {
+  const int c = (bytes - 1) / SLAB_STEP;
+  run_t *run = runs[c];
+  if (run == NULL && (run = new_run(c)) == NULL)
+    return NULL;
+
+  int w;
+  for (w = 0; run->map[w] == 0; w++);
+  const int k = __builtin_ctz(run->map[w]);
+  run->map[w] &= ~(1u << k);
+  if (--run->free == 0)
+    pop_run(run, &runs[c]);
+
+  return (char *)(run + 1) + (w * 32 + k) * run->bytes;
+}
+
+/*
+ * slab_free - frees a slot, giving its run up as spare once none are in use
+ *  will abort program if ptr is certainly not an allocated slot.
+ */
+static void slab_free(void *const ptr) {
+  run_t *const run = get_run(ptr);
+  const size_t offset = (char *)ptr - (char *)(run + 1);
+  if ((char *)ptr >= (char *)mem_arena_lo(slab_arena) + mem_arena_heapsize(slab_arena)
+      || (char *)ptr < (char *)(run + 1) || run->bytes == 0
+      || offset % run->bytes != 0 || offset / run->bytes >= get_slots(run->bytes)) {
+    fprintf(stderr, "%p is not a valid block\n", ptr);
+    abort();
+  }
+
+  const unsigned k = offset / run->bytes;
+  if (run->map[k / 32] & 1u << k % 32) {
+    fprintf(stderr, "%p is the payload of an already freed block\n", ptr);
+    abort();
+  }
+  run->map[k / 32] |= 1u << k % 32;
+
+  const int c = run->bytes / SLAB_STEP - 1;
+  if (run->free++ == 0)
+    push_run(run, &runs[c]);
+  if (run->free == get_slots(run->bytes)) {
+    pop_run(run, &runs[c]);
+    run->bytes = 0;
+    push_run(run, &spare_runs);
+  }
+}
+#endif
+
+#ifdef MMAP
+/*
+ * is_mapped - checks whether a pointer is in a mapping rather than the heap
+ */
+inline static int is_mapped(void *const ptr) {
+  return !mem_in_heap(ptr);
+}
 
-  next = mem_heap_lo();
+/*
+ * map_allocate - maps a block of its own for a payload of bytes,
+ *  whose size covers the rest of the last page as well
+ *  returns NULL on failure to map it.
+ */
+static void *map_allocate(const size_t bytes) {
+  const size_t page = mem_pagesize();
+  const size_t total = (bytes + sizeof(unit_t) + page - 1) & ~(page - 1);
+  if (total < bytes || total / sizeof(unit_t) - 2 >= (size_t)1 << SIZE_BITS)
+    return NULL;
+
+  header_t *const block = mem_map(total);
+  if (block == NULL)
+    return NULL;
+  block->size = total / sizeof(unit_t) - 2;
+  block->prev_alloc = 1;
+  block->alloc = 1;
+  block->i = -1;
+  return (unit_t *)block + 1;
+}
+
+/*
+ * map_free - unmaps a mapped block
+ *  will abort program if ptr is certainly not an allocated block.
+ */
+static void map_free(void *const ptr) {
+  if (mem_unmap((unit_t *)ptr - 1) < 0) {
+    fprintf(stderr, "%p is not a valid block\n", ptr);
+    abort();
+  }
+}
+
+/*
+ * map_reallocate - remaps a mapped block to fit bytes,
+ *  unless it has shrunk enough for the heap, where it is moved.
+ *  returns NULL on failure to remap it.
+ */
+static void *map_reallocate(void *const ptr, const size_t bytes) {
+  header_t *block = (header_t *)((unit_t *)ptr - 1);
+  const size_t payload_bytes = (block->size + 1) * sizeof(unit_t);
+
+  if (bytes < MMAP_BYTES) {
+    void *const newPtr = mm_malloc(bytes);
+    if (newPtr == NULL)
+      return NULL;
+    memcpy(newPtr, ptr, bytes);
+    map_free(ptr);
+    return newPtr;
+  }
+
+  const size_t page = mem_pagesize();
+  const size_t total = (bytes + sizeof(unit_t) + page - 1) & ~(page - 1);
+  if (total == payload_bytes + sizeof(unit_t))
+    return ptr;
+  if (total < bytes || total / sizeof(unit_t) - 2 >= (size_t)1 << SIZE_BITS)
+    return NULL;
+
+  block = mem_remap(block, total);
+  if (block == NULL)
+    return NULL;
+  block->size = total / sizeof(unit_t) - 2;
+  return (unit_t *)block + 1;
+}
+#endif
+
+/* 
+ * mm_init - initialize the malloc package.
+ */
+int mm_init(void) {
+#if defined(THREADS) || defined(ARENAS)
+  generation++;
+#endif
+#ifdef ARENAS
+  num_arenas = 1;
+  init_arena(&arenas[0], 0);
+#else
+  init_arena(&heap, 0);
+#endif
+#ifdef SLABS
+  init_slabs();
+#endif
 
   return 0;
 }
@@ -431,7 +2002,34 @@ int mm_init(void) {
 void *mm_malloc(const size_t size) {
   if (size == 0)
     return NULL;
+#ifdef MMAP
+  if (size >= MMAP_BYTES)
+    return map_allocate(size);
+#endif
+#if defined(THREADS)
+  return cached_allocate(bytes_to_units(size));
+#elif defined(ARENAS)
+  get_arena();
+  lock_heap();
+  drain_remote();
+  unit_t *payload = allocate(bytes_to_units(size));
+  unlock_heap();
+  arena_t *own;
+  if (payload == NULL && (own = fall_back()) != NULL) {
+    payload = allocate(bytes_to_units(size));
+    come_back(own);
+  }
+  return payload;
+#else
+#ifdef SLABS
+  if (size <= MAX_SLAB_BYTES && slab_arena > 0) {
+    void *const slot = slab_allocate(size);
+    if (slot != NULL)
+      return slot;
+  }
+#endif
   return allocate(bytes_to_units(size));
+#endif
 }
 
 /*
@@ -439,8 +2037,261 @@ void *mm_malloc(const size_t size) {
  *  will abort program if ptr is certainly not an allocated block.
  */
 void mm_free(void *const ptr) {
-  if (ptr != NULL)
-    free_block(get_header(ptr));
+  if (ptr == NULL)
+    return;
+#ifdef SLABS
+  if (is_slot(ptr)) {
+    slab_free(ptr);
+    return;
+  }
+#endif
+#ifdef MMAP
+  if (is_mapped(ptr)) {
+    map_free(ptr);
+    return;
+  }
+#endif
+
+  free_heap_block(get_header(ptr));
+}
+
+/*
+ * mm_free_sized - Frees a block of size bytes, as it was allocated or reallocated with,
+ *  or as mm_usable_size gave for it, without looking at its footer.
+ *  will abort program if ptr is certainly not an allocated block of that size.
+ */
+void mm_free_sized(void *const ptr, const size_t size) {
+  if (ptr == NULL)
+    return;
+#ifdef SLABS
+  // the size does not say whether there was a run for it
+  if (is_slot(ptr)) {
+    slab_free(ptr);
+    return;
+  }
+#endif
+#ifdef MMAP
+  if (is_mapped(ptr)) {
+    map_free(ptr);
+    return;
+  }
+#endif
+
+  free_heap_block(get_sized_header(ptr, size));
+}
+
+/*
+ * free_heap_block - frees an allocated block of the heap, by way of the cache with THREADS,
+ *  and by way of its arena's remote list if it is another arena's
+ */
+static void free_heap_block(header_t *const block) {
+#if defined(THREADS)
+  cached_free(block);
+#elif defined(ARENAS)
+  arena_t *const owner = &arenas[mem_arena_of(block)];
+  if (owner != get_arena()) {
+    free_remote(owner, block);
+    return;
+  }
+
+  lock_heap();
+  coalesce_block(block);
+  unlock_heap();
+#else
+  coalesce_block(block);
+#endif
+}
+
+/*
+ * mm_usable_size - Gets how many bytes a block can hold, at least as many as it was
+ *  allocated with, all of which are the caller's to use. Returns 0 for NULL.
+ *  will abort program if ptr is certainly not an allocated block.
+ */
+size_t mm_usable_size(void *const ptr) {
+  if (ptr == NULL)
+    return 0;
+#ifdef SLABS
+  if (is_slot(ptr))
+    return get_run(ptr)->bytes;
+#endif
+#ifdef MMAP
+  if (is_mapped(ptr))
+    return (((header_t *)((unit_t *)ptr - 1))->size + 1) * sizeof(unit_t);
+#endif
+  return get_payload_bytes(get_header(ptr)->size);
+}
+
+/*
+ * zero_payload - clears bytes of a payload,
+ *  streaming them past the cache if there are enough that it would only be thrashed.
+ */
+static void zero_payload(void *const payload, size_t bytes) {
+#ifdef __SSE2__
+  if (bytes >= STREAM_BYTES) {
+    char *p = payload;
+    // payloads are only unit-aligned
+    const size_t head = -(uintptr_t)p & 15;
+    memset(p, 0, head);
+    p += head;
+    bytes -= head;
+
+    const __m128i zero = _mm_setzero_si128();
+    for (; bytes >= 64; p += 64, bytes -= 64) {
+      _mm_stream_si128((__m128i *)p, zero);
+      _mm_stream_si128((__m128i *)p + 1, zero);
+      _mm_stream_si128((__m128i *)p + 2, zero);
+      _mm_stream_si128((__m128i *)p + 3, zero);
+    }
+    _mm_sfence();
+    memset(p, 0, bytes);
+    return;
+  }
+#endif
+  memset(payload, 0, bytes);
+}
+
+/*
+ * mm_calloc - Allocate a block of nmemb * size bytes that are all zero.
+ *  If either is 0, returns NULL as a "success."
+ *  Otherwise, returns non-NULL on success, NULL on failure to grow the heap
+ *  or if the product overflows.
+ */
+void *mm_calloc(const size_t nmemb, const size_t size) {
+  if (nmemb == 0 || size == 0 || nmemb > SIZE_MAX / size)
+    return NULL;
+  const size_t bytes = nmemb * size;
+#ifdef MMAP
+  // a new mapping is fresh
+  if (bytes >= MMAP_BYTES)
+    return map_allocate(bytes);
+#endif
+  if (bytes < mem_pagesize()) {
+    void *const payload = mm_malloc(bytes);
+    if (payload != NULL)
+      memset(payload, 0, bytes);
+    return payload;
+  }
+
+#ifdef ARENAS
+  get_arena();
+#endif
+  lock_heap();
+#ifdef ARENAS
+  drain_remote();
+#endif
+  // a block that starts past what the arena ever used was carved from fresh memory
+  unit_t *fresh = mem_arena_fresh(arena->index);
+  unit_t *payload = allocate(bytes_to_units(bytes));
+  unlock_heap();
+#ifdef ARENAS
+  arena_t *own;
+  if (payload == NULL && (own = fall_back()) != NULL) {
+    fresh = mem_arena_fresh(0);
+    payload = allocate(bytes_to_units(bytes));
+    come_back(own);
+  }
+#endif
+  if (payload != NULL && payload < fresh)
+    zero_payload(payload, bytes);
+  return payload;
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload is a multiple of alignment, a power of 2.
+ *  the block is always in the heap, since neither slots nor mappings can be aligned.
+ *  If size == 0, returns NULL as a "success."
+ *  If size > 0, returns non-NULL on success, NULL on failure to grow the heap
+ *  or if alignment is not a power of 2.
+ */
+void *mm_memalign(const size_t alignment, const size_t size) {
+  if (size == 0 || alignment == 0 || (alignment & (alignment - 1)))
+    return NULL;
+#ifdef ARENAS
+  get_arena();
+#endif
+  lock_heap();
+#ifdef ARENAS
+  drain_remote();
+#endif
+  unit_t *payload = allocate_aligned(alignment, bytes_to_units(size));
+  unlock_heap();
+#ifdef ARENAS
+  arena_t *own;
+  if (payload == NULL && (own = fall_back()) != NULL) {
+    payload = allocate_aligned(alignment, bytes_to_units(size));
+    come_back(own);
+  }
+#endif
+  return payload;
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into ptrs, holding the lock once.
+ *  returns how many were allocated, which is n unless the heap failed to grow,
+ *  or none if size == 0.
+ */
+size_t mm_malloc_batch(const size_t size, void **const ptrs, const size_t n) {
+  size_t k = 0;
+  if (size == 0)
+    return 0;
+#ifdef MMAP
+  if (size >= MMAP_BYTES) {
+    while (k < n && (ptrs[k] = map_allocate(size)) != NULL)
+      k++;
+    return k;
+  }
+#endif
+  const size_t units = bytes_to_units(size);
+#ifdef THREADS
+  // the cache already takes the lock only once a batch of small blocks
+  if (get_class_index(units) < NUM_SMALL_CLASSES) {
+    while (k < n && (ptrs[k] = cached_allocate(units)) != NULL)
+      k++;
+    return k;
+  }
+#endif
+#ifdef SLABS
+  if (size <= MAX_SLAB_BYTES && slab_arena > 0)
+    while (k < n && (ptrs[k] = slab_allocate(size)) != NULL)
+      k++;
+#endif
+#ifdef ARENAS
+  get_arena();
+#endif
+  lock_heap();
+#ifdef ARENAS
+  drain_remote();
+#endif
+  k += allocate_batch(units, ptrs + k, n - k);
+  unlock_heap();
+#ifdef ARENAS
+  arena_t *own;
+  if (k < n && (own = fall_back()) != NULL) {
+    k += allocate_batch(units, ptrs + k, n - k);
+    come_back(own);
+  }
+#endif
+  return k;
+}
+
+/*
+ * mm_free_batch - Frees n blocks from ptrs, holding the lock once.
+ *  will abort program if any of them is certainly not an allocated block.
+ */
+void mm_free_batch(void **const ptrs, const size_t n) {
+#ifdef THREADS
+  // small blocks go to the cache, which already takes the lock only once a batch
+  size_t k;
+  for (k = 0; k < n; k++)
+    mm_free(ptrs[k]);
+#else
+#ifdef ARENAS
+  get_arena();
+#endif
+  lock_heap();
+  free_batch(ptrs, n);
+  unlock_heap();
+#endif
 }
 
 /*
@@ -457,28 +2308,89 @@ void *mm_realloc(void *const ptr, const size_t bytes) {
     return NULL;
   }
 
+#ifdef MMAP
+  if (is_mapped(ptr))
+    return map_reallocate(ptr, bytes);
+#endif
+#ifdef ARENAS
+  // a block of another arena cannot be resized in this one, so it is moved
+  header_t *const block = get_header(ptr);
+  if (&arenas[mem_arena_of(block)] != get_arena()) {
+    void *const newPtr = mm_malloc(bytes);
+    if (newPtr == NULL)
+      return NULL;
+    const size_t old_bytes = get_payload_bytes(block->size);
+    memcpy(newPtr, ptr, old_bytes < bytes ? old_bytes : bytes);
+    mm_free(ptr);
+    return newPtr;
+  }
+#endif
+#ifdef SLABS
+  // a slot keeps its size, so it is only moved if it is outgrown
+  if (is_slot(ptr)) {
+    const run_t *const run = get_run(ptr);
+    if (bytes <= run->bytes)
+      return ptr;
+    void *const newPtr = mm_malloc(bytes);
+    if (newPtr == NULL)
+      return NULL;
+    memcpy(newPtr, ptr, run->bytes);
+    mm_free(ptr);
+    return newPtr;
+  }
+#endif
+#ifdef MMAP
+  // a block that outgrows the heap is moved into a mapping once, to be remapped from then on
+  if (bytes >= MMAP_BYTES) {
+    const size_t old_bytes = get_payload_bytes(get_header(ptr)->size);
+    if (bytes > old_bytes) {
+      void *const newPtr = map_allocate(bytes);
+      if (newPtr == NULL)
+	return NULL;
+      memcpy(newPtr, ptr, old_bytes);
+      mm_free(ptr);
+      return newPtr;
+    }
+  }
+#endif
+
+  lock_heap();
+  void *newPtr = reallocate(ptr, bytes);
+  unlock_heap();
+#ifdef ARENAS
+  // with no room left in its arena, the block is moved to the heap itself
+  if (newPtr == NULL && arena != &arenas[0] && (newPtr = mm_malloc(bytes)) != NULL) {
+    memcpy(newPtr, ptr, get_payload_bytes(block->size));
+    mm_free(ptr);
+  }
+#endif
+
+  return newPtr;
+}
+
+/*
+ * reallocate - resizes a block by coalescing with its neighbours in the heap if possible,
+ *  otherwise moves it.
+ *  returns NULL on failure to grow the heap.
+ */
+static void *reallocate(void *const ptr, const size_t bytes) {
+  assert(ptr != NULL);
+  assert(bytes);
+
   header_t *const block = get_header(ptr);
   const size_t prev_size = block->size;
   const size_t size = bytes_to_units(bytes);
 
   if (size == prev_size) {
+    tally(realloc_shrink, 1);
     return ptr;
   }
 
   // if smaller size, attempt to split the block
   if (size < prev_size) {
-    const size_t remaining = prev_size - size;
-    if (remaining < MIN_BLOCK_UNITS)
-      return ptr;
-    
-    block->size = size;
-    set_footer(block);
-    
-    header_t *const right = get_next_in_heap(block);
-    right->size = remaining - MIN_BLOCK_UNITS;
-    right->alloc = 1;
-    free_block(right);
-
+    tally(realloc_shrink, 1);
+    if (prev_size - size >= MIN_BLOCK_UNITS + get_slack(size))
+      shrink_block(block, size);
     return ptr;
   }
 
@@ -490,7 +2402,7 @@ void *mm_realloc(void *const ptr, const size_t bytes) {
   header_t *iter;
   size_t total;
   for (iter = right, total = 0;
-       total < needed && (unit_t *)iter < next && !iter->alloc;
+       total < needed && (unit_t *)iter < arena->next && !iter->alloc;
        iter = get_next_in_heap(iter))
     total += get_total_units(iter);
   header_t *const rightmost = iter;
@@ -498,6 +2410,7 @@ void *mm_realloc(void *const ptr, const size_t bytes) {
   // colaesce then possibly split the last block
   if (total >= needed) {
     log("Right coalescing ");
+    tally(realloc_right, 1);
 
     header_t *inext;
     for (iter = right;
@@ -518,8 +2431,10 @@ void *mm_realloc(void *const ptr, const size_t bytes) {
     // you can't have 0-blocks
     else if (extra > iter->size) {
       log("absorbing 0-left block\n");
+      // if the 1-block leaves too little for a right block,
+      // split_block keeps it whole, so absorb all of it
+      block->size = size + extra - (iter->size < MIN_BLOCK_UNITS ? 0 : iter->size);
       split_block(iter, 0); // 0 for a 1-block
-      block->size = size + extra - iter->size;
     }
     else {
       log("splitting normally\n");
@@ -550,6 +2465,7 @@ void *mm_realloc(void *const ptr, const size_t bytes) {
   header_t *const leftmost = iter;
   if (total >= needed) {
     log("Left and right coalescing ");
+    tally(realloc_left, 1);
     for (iter = right; iter < rightmost; iter = get_next_in_heap(iter))
       allocate_block(iter);
 
@@ -559,35 +2475,47 @@ void *mm_realloc(void *const ptr, const size_t bytes) {
       inext = iter;
     }
 
-    const size_t extra = total - needed;
+    // the block is copied anyway, so it takes what slack it can of the rest
+    const size_t slack = total - needed < get_slack(size) ? total - needed : get_slack(size);
+    const size_t extra = total - needed - slack;
     header_t *newBlock;
 
     if (extra < MIN_BLOCK_UNITS) {
       log("with absorbing first block\n");
       newBlock = inext;
-      newBlock->size = size + extra;
+      newBlock->size = size + slack + extra;
     }
     else {
       log("without absorbing first block\n");
+      // the new header goes first, since freeing inext marks the block after it
+      newBlock = (header_t *)((unit_t *)inext + extra);
+      newBlock->size = size + slack;
+      newBlock->alloc = 1;
       inext->size = extra - MIN_BLOCK_UNITS;
       free_block(inext);
-      newBlock = get_next_in_heap(inext);
-      newBlock->size = size;
     }
 
-    newBlock->alloc = 1;
+    set_alloc(newBlock, 1);
     set_footer(newBlock);
     unit_t *const newPtr = get_payload(newBlock);
-    memmove(newPtr, ptr, (prev_size + 1) * sizeof(*newPtr));
+    memmove(newPtr, ptr, get_payload_bytes(prev_size));
 
     return newPtr;
   }
 
   // coalesce then grow heap
-  if ((unit_t *)rightmost == next) {
+  if ((unit_t *)rightmost == arena->next) {
     log("Heap growing case ");
+#ifdef ELIDE_FOOTERS
+    header_t *const grown = (header_t *)arena->next;
+#endif
     if (grow_heap(needed - total) < 0)
       return NULL;
+    tally(realloc_grow, 1);
+#ifdef ELIDE_FOOTERS
+    // absorbing the last free block marks the block after it, which is only new space
+    grown->alloc = 1;
+#endif
 
     for (iter = right; iter < rightmost; iter = get_next_in_heap(iter))
       allocate_block(iter);
@@ -595,6 +2523,7 @@ void *mm_realloc(void *const ptr, const size_t bytes) {
     if (left == leftmost) {
       log("without left coalescing\n");
       block->size = size;
+      set_alloc(block, 1);
       set_footer(block);
       return ptr;
     }
@@ -607,20 +2536,90 @@ void *mm_realloc(void *const ptr, const size_t bytes) {
     }
 
     inext->size = size;
+    set_alloc(inext, 1);
     set_footer(inext);
     unit_t *const newPtr = get_payload(inext);
-    memmove(newPtr, ptr, (prev_size + 1) * sizeof(*newPtr));
+    memmove(newPtr, ptr, get_payload_bytes(prev_size));
     
     return newPtr;
   }
 
   log("New case\n");
-  unit_t *const newPtr = allocate(size);
-  if (newPtr == NULL)
+  unit_t *newPtr = allocate(size + get_slack(size));
+  if (newPtr == NULL && (newPtr = allocate(size)) == NULL)
     return NULL;
-  memmove(newPtr, ptr, (prev_size + 1) * sizeof(*newPtr));
-  free_block(block);
+  tally(realloc_move, 1);
+  memmove(newPtr, ptr, get_payload_bytes(prev_size));
+  coalesce_block(block);
   
   return newPtr;
 }
 
+/*
+ * get_slack - gets how many units more than units of payload - 1
+ *  a block that realloc moves is given to grow into
+ */
+inline static size_t get_slack(const size_t units) {
+#ifdef REALLOC_SLACK
+  const size_t slack = (units + 1) / 4;
+  return slack < REALLOC_SLACK_BYTES / sizeof(unit_t) ? slack : REALLOC_SLACK_BYTES / sizeof(unit_t);
+#else
+  return 0;
+#endif
+}
+
+/*
+ * mm_stats - fills in the counters of every arena, under their locks.
+ *  returns -1 without STATS.
+ */
+int mm_stats(mm_stats_t *const stats) {
+#ifdef STATS
+  memset(stats, 0, sizeof(*stats));
+  stats->num_classes = NUM_CLASSES;
+
+#ifdef ARENAS
+  pthread_mutex_lock(&arenas_lock);
+  int k;
+  for (k = 0; k < num_arenas; k++) {
+    pthread_mutex_lock(&arenas[k].lock);
+    add_stats(stats, &arenas[k]);
+    pthread_mutex_unlock(&arenas[k].lock);
+  }
+  pthread_mutex_unlock(&arenas_lock);
+#else
+  lock_heap();
+  add_stats(stats, arena);
+  unlock_heap();
+#endif
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/*
+ * mm_heap_walk - calls walk on every block of every arena, under their locks,
+ *  then on every slot of the runs.
+ *  cached and remotely freed blocks look allocated, as they do to the rest of the heap.
+ *  returns the number of classes.
+ */
+int mm_heap_walk(const mm_walk_t walk, void *const arg) {
+#ifdef ARENAS
+  pthread_mutex_lock(&arenas_lock);
+  int k;
+  for (k = 0; k < num_arenas; k++) {
+    pthread_mutex_lock(&arenas[k].lock);
+    walk_arena(&arenas[k], walk, arg);
+    pthread_mutex_unlock(&arenas[k].lock);
+  }
+  pthread_mutex_unlock(&arenas_lock);
+#else
+  lock_heap();
+  walk_arena(arena, walk, arg);
+  unlock_heap();
+#endif
+#ifdef SLABS
+  walk_slabs(walk, arg);
+#endif
+  return NUM_CLASSES;
+}
@@ -14,6 +14,8 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -44,6 +46,9 @@ team_t team = {
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
+/* set in the size of a freed block, which is never reused */
+#define FREED ((size_t)1 << (sizeof(size_t) * 8 - 1))
+
 /* 
  * mm_init - initialize the malloc package.
  */
@@ -69,10 +74,100 @@ void *mm_malloc(size_t size)
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * mm_free - Freeing a block does nothing but mark it freed for mm_heap_walk.
  */
 void mm_free(void *ptr)
 {
+    if (ptr != NULL)
+        *(size_t *)((char *)ptr - SIZE_T_SIZE) |= FREED;
+}
+
+/*
+ * mm_calloc - Allocate a block of zeros, which only needs clearing if
+ *     the brk pointer has been past it before.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    char *fresh, *p;
+
+    if (nmemb == 0 || size == 0 || nmemb > SIZE_MAX / size)
+        return NULL;
+    fresh = mem_arena_fresh(0);
+    p = mm_malloc(nmemb * size);
+    if (p != NULL && p < fresh)
+        memset(p, 0, nmemb * size);
+    return p;
+}
+
+/*
+ * mm_memalign - Allocate a block after a freed one that pads the brk pointer
+ *     out to where an aligned payload starts.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    size_t payload, pad;
+
+    if (size == 0 || alignment == 0 || (alignment & (alignment - 1)))
+        return NULL;
+    payload = (size_t)mem_heap_hi() + 1 + SIZE_T_SIZE;
+    pad = (alignment - payload % alignment) % alignment;
+    if (pad > 0) {
+        /* pad is a multiple of ALIGNMENT, so it takes a block of its own */
+        char *p = mm_malloc(pad - SIZE_T_SIZE);
+        if (p == NULL)
+            return NULL;
+        mm_free(p);
+    }
+    return mm_malloc(size);
+}
+
+/*
+ * mm_free_sized - There is nothing for the size to save.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    mm_free(ptr);
+}
+
+/*
+ * mm_usable_size - The size of a block is what it was allocated with.
+ */
+size_t mm_usable_size(void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+    return *(size_t *)((char *)ptr - SIZE_T_SIZE) & ~FREED;
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks by incrementing the brk pointer once.
+ */
+size_t mm_malloc_batch(size_t size, void **ptrs, size_t n)
+{
+    size_t newsize = ALIGN(size + SIZE_T_SIZE);
+    char *p;
+    size_t k;
+
+    if (size == 0 || n == 0 || n > INT_MAX / newsize)
+        return 0;
+    if ((p = mem_sbrk(n * newsize)) == (void *)-1)
+        return 0;
+    for (k = 0; k < n; k++, p += newsize) {
+        *(size_t *)p = size;
+        ptrs[k] = p + SIZE_T_SIZE;
+    }
+    return n;
+}
+
+/*
+ * mm_free_batch - Mark every block freed, as mm_free does.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t k;
+
+    for (k = 0; k < n; k++)
+        mm_free(ptrs[k]);
 }
 
 /*
@@ -95,16 +190,32 @@ void *mm_realloc(void *ptr, size_t size)
     return newptr;
 }
 
+/*
+ * mm_stats - Nothing is counted here.
+ */
+int mm_stats(mm_stats_t *stats)
+{
+    return -1;
+}
 
-
-
-
-
-
-
-
-
-
-
-
+/*
+ * mm_heap_walk - Every block is in the heap in the order it was
+ *     allocated, and none has a class.
+ */
+int mm_heap_walk(mm_walk_t walk, void *arg)
+{
+    char *p = mem_heap_lo();
+    mm_block_t b;
+
+    while (p < (char *)mem_heap_lo() + mem_heapsize()) {
+        size_t size = *(size_t *)p & ~FREED;
+        b.payload = p + SIZE_T_SIZE;
+        b.bytes = size;
+        b.alloc = !(*(size_t *)p & FREED);
+        b.class_index = -1;
+        walk(&b, arg);
+        p += ALIGN(size + SIZE_T_SIZE);
+    }
+    return 0;
+}
 
@@ -0,0 +1,10 @@
+/*
+ * mm-threaded.c - mm-double.c made safe to call from multiple threads.
+ *
+ * Each thread keeps a cache of small blocks of its own,
+ * so the heap lock is only taken to refill or flush a cache in a batch
+ * and for blocks too large to be cached.
+ * See THREADS in mm-double.c.
+ */
+#define THREADS
+#include "mm-double.c"
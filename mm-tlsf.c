@@ -0,0 +1,753 @@
+/*
+ * mm-tlsf.c - A 32-bit malloc implementation based on two-level segregated fit (TLSF)
+ * on a doubly-linked heap.
+ *
+ * A unit is 64 bits.
+ * An n-block consists of 1 block for the header + n blocks for the payload
+ * + 1 block for the footer, the same as in mm-double.c.
+ * If the block is free then its header also holds the links
+ * of a doubly-linked free list.
+ * Freed blocks are immediately coalesced with their free neighbours.
+ *
+ * The free lists form a two-level table indexed by payload size:
+ * + The first level splits sizes by powers of 2
+ * + The second level splits each power of 2 into SL_COUNT equal ranges
+ * Payloads of fewer than SL_COUNT units get exact lists in the first row.
+ * A bitmap per level records which lists are non-empty,
+ * so malloc finds a fit with two bit scans and free is a constant number
+ * of list operations, without ever walking a list.
+ * malloc rounds the request up to the next list boundary first,
+ * so that any block in the list it finds is large enough.
+ * mm_memalign pads its request by enough to find an aligned payload at least
+ * a whole block into it, and splits off and frees the leading part and the end.
+ * With TRIM, a merged free block of at least TRIM_BYTES is given back:
+ * the heap shrinks if the block ends it, otherwise the pages inside it are released.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define DEBUG
+#ifdef DEBUG
+#include <assert.h>
+#else
+#define assert(...)
+#endif
+
+// give back large free blocks, at the cost of faulting their pages back in if they are reused,
+// e.g. with make DEBUG="-DTRIM -DTRIM_BYTES=65536"
+//#define TRIM
+#ifndef TRIM_BYTES
+#define TRIM_BYTES (128 << 10)
+#endif
+// count what the allocator does for mm_stats, e.g. with make DEBUG=-DSTATS
+//#define STATS
+
+
+/*********************************************************
+ * NOTE TO STUDENTS: Before you do anything else, please
+ * provide your team information in the following struct.
+ ********************************************************/
+team_t team = {
+  /* Team name */
+  "ateam",
+  /* First member's full name */
+  "Harry Bovik",
+  /* First member's email address */
+  "bovik@cs.cmu.edu",
+  /* Second member's full name (leave blank if none) */
+  "",
+  /* Second member's email address (leave blank if none) */
+  ""
+};
+
+enum {
+  SIZE_BITS = 29,
+  SL_LOG2 = 3,
+  SL_COUNT = 1 << SL_LOG2,
+  // the first row holds the exact small sizes, then 1 row per power of 2
+  FL_COUNT = SIZE_BITS - SL_LOG2 + 1,
+
+  UNIT_BYTES = 8,
+  MIN_BLOCK_UNITS = 3
+};
+
+typedef struct {
+  char data[UNIT_BYTES];
+} unit_t;
+
+// size is 1 less than the payload size in units
+#define SIZE_INFO size_t size: SIZE_BITS; \
+  unsigned padding: 2; \
+  unsigned alloc: 1
+
+typedef struct header {
+  SIZE_INFO;
+  struct header *prev;
+  struct header *next;
+} header_t;
+
+typedef struct {
+  SIZE_INFO;
+} footer_t;
+
+#undef SIZE_INFO
+
+static unsigned fl_bitmap; // bit fl is set iff sl_bitmap[fl] != 0
+static unsigned sl_bitmap[FL_COUNT]; // bit sl is set iff lists[fl][sl] != NULL
+static header_t *lists[FL_COUNT][SL_COUNT];
+static unit_t *next;
+#ifdef STATS
+static mm_stats_t stats; // all but the free list lengths, which are counted by mm_stats
+#define tally(counter, n) (stats.counter += (n))
+#else
+#define tally(counter, n)
+#endif
+
+static size_t bytes_to_units(size_t);
+static void get_indices(size_t, int *, int *);
+static size_t round_up(size_t);
+static size_t get_total_units(header_t *);
+static header_t *get_header(void *);
+static header_t *get_sized_header(void *, size_t);
+static unit_t *get_payload(header_t *);
+static header_t *get_next_in_heap(header_t *);
+static header_t *get_prev_in_heap(header_t *);
+static header_t *get_last_in_heap(void);
+static footer_t *get_footer(header_t *);
+static int is_footer_valid(header_t *);
+static void set_footer(header_t *);
+static void insert_block(header_t *);
+static void remove_block(header_t *);
+static header_t *find_block(size_t);
+static void release_block(header_t *);
+#ifdef TRIM
+static int trim_block(header_t *);
+#endif
+static void split_block(header_t *, size_t);
+static unit_t *allocate(size_t);
+static unit_t *allocate_aligned(size_t, size_t);
+static unit_t *allocate_next(size_t);
+static int grow_heap(size_t);
+
+/*
+ * bytes_to_units - converts bytes to units - 1 by taking the ceiling of bytes / UNIT_BYTES - 1
+ */
+inline static size_t bytes_to_units(const size_t bytes) {
+  assert(bytes);
+  return bytes / sizeof(unit_t) - (bytes % sizeof(unit_t) == 0);
+}
+
+/*
+ * get_indices - gets the first- and second-level indices of the list for units of payload - 1
+ */
+inline static void get_indices(const size_t units, int *const fl, int *const sl) {
+  const size_t n = units + 1;
+  if (n < SL_COUNT) {
+    *fl = 0;
+    *sl = n;
+    return;
+  }
+
+  const int log = 31 - __builtin_clz(n);
+  *fl = log - SL_LOG2 + 1;
+  *sl = (n >> (log - SL_LOG2)) - SL_COUNT;
+}
+
+/*
+ * round_up - rounds units of payload - 1 up to the last size of its list,
+ *  so that every block of the next list up is large enough
+ */
+inline static size_t round_up(const size_t units) {
+  const size_t n = units + 1;
+  if (n < SL_COUNT)
+    return units;
+  return units + ((size_t)1 << (31 - __builtin_clz(n) - SL_LOG2)) - 1;
+}
+
+/*
+ * get_total_units - gets the block's total number of units, including header
+ */
+inline static size_t get_total_units(header_t *const block) {
+  assert(is_footer_valid(block));
+  return MIN_BLOCK_UNITS + block->size;
+}
+
+/*
+ * get_next_in_heap - get the block immediately after a given block in the heap, NOT the free list
+ */
+inline static header_t *get_next_in_heap(header_t *const block) {
+  return (header_t *)((unit_t *)block + get_total_units(block));
+}
+
+/*
+ * get_prev_in_heap - get the block immediately before a given block in the heap
+ *  returns NULL for the first block.
+ */
+inline static header_t *get_prev_in_heap(header_t *const block) {
+  assert(block >= (header_t *)mem_heap_lo());
+  if (block == mem_heap_lo())
+    return NULL;
+  return (header_t *)((unit_t *)block - MIN_BLOCK_UNITS
+		      - ((footer_t *)((unit_t *)block - 1))->size);
+}
+
+/*
+ * get_last_in_heap - get the last block in the heap, or NULL if the heap is empty
+ */
+inline static header_t *get_last_in_heap(void) {
+  return get_prev_in_heap((header_t *)next);
+}
+
+/*
+ * get_header - gets a payload's header
+ */
+inline static header_t *get_header(void *const payload) {
+  header_t *const header = (header_t *)((unit_t *)payload - 1);
+  if (!is_footer_valid(header)) {
+    fprintf(stderr, "%p is not a valid block\n", payload);
+    abort();
+  }
+  if (!header->alloc) {
+    fprintf(stderr, "%p is the payload of an already freed block\n", payload);
+    abort();
+  }
+  return header;
+}
+
+/*
+ * get_sized_header - gets the header of a payload the caller says holds bytes,
+ *  which checks them against the header's size instead of the footer against the header
+ */
+inline static header_t *get_sized_header(void *const payload, const size_t bytes) {
+  header_t *const header = (header_t *)((unit_t *)payload - 1);
+  if (bytes > (header->size + 1) * sizeof(unit_t)) {
+    fprintf(stderr, "%p is not a valid block of %u bytes\n", payload, (unsigned)bytes);
+    abort();
+  }
+  if (!header->alloc) {
+    fprintf(stderr, "%p is the payload of an already freed block\n", payload);
+    abort();
+  }
+  return header;
+}
+
+/*
+ * get_payload - gets a block's payload
+ */
+inline static unit_t *get_payload(header_t *const block) {
+  return (unit_t *)block + 1;
+}
+
+/*
+ * get_footer - gets a block's footer
+ */
+inline static footer_t *get_footer(header_t *const block) {
+  return (footer_t *)((unit_t *)block + MIN_BLOCK_UNITS + block->size - 1);
+}
+
+/*
+ * is_footer_valid - checks whether a footer is valid
+ */
+inline static int is_footer_valid(header_t *const header) {
+  return !memcmp(get_footer(header), header, sizeof(footer_t));
+}
+
+/*
+ * set_footer - sets a block's footer
+ */
+inline static void set_footer(header_t *const block) {
+  *get_footer(block) = *(footer_t *)block;
+}
+
+/*
+ * insert_block - frees a block and pushes it onto the head of its list
+ */
+static void insert_block(header_t *const block) {
+  int fl, sl;
+  get_indices(block->size, &fl, &sl);
+
+  block->alloc = 0;
+  block->prev = NULL;
+  block->next = lists[fl][sl];
+  if (block->next != NULL)
+    block->next->prev = block;
+  lists[fl][sl] = block;
+  set_footer(block);
+
+  sl_bitmap[fl] |= 1u << sl;
+  fl_bitmap |= 1u << fl;
+}
+
+/*
+ * remove_block - removes a free block from its list and marks it allocated
+ */
+static void remove_block(header_t *const block) {
+  assert(!block->alloc);
+  int fl, sl;
+  get_indices(block->size, &fl, &sl);
+
+  if (block->prev == NULL) {
+    assert(lists[fl][sl] == block);
+    lists[fl][sl] = block->next;
+    if (block->next == NULL) {
+      sl_bitmap[fl] &= ~(1u << sl);
+      if (sl_bitmap[fl] == 0)
+	fl_bitmap &= ~(1u << fl);
+    }
+  } else
+    block->prev->next = block->next;
+  if (block->next != NULL)
+    block->next->prev = block->prev;
+
+  block->alloc = 1;
+  set_footer(block);
+}
+
+/*
+ * find_block - finds a free block with a payload of at least units - 1
+ *  returns NULL if no list that is sure to fit has a block.
+ */
+static header_t *find_block(const size_t units) {
+  int fl, sl;
+  get_indices(round_up(units), &fl, &sl);
+  if (fl >= FL_COUNT)
+    return NULL;
+
+  // first try the rest of the row, then the next non-empty row
+  unsigned bits = sl_bitmap[fl] & (~0u << sl);
+  if (bits == 0) {
+    tally(escalations, 1);
+    const unsigned rows = fl_bitmap & (~0u << (fl + 1));
+    if (rows == 0)
+      return NULL;
+    fl = __builtin_ctz(rows);
+    bits = sl_bitmap[fl];
+  }
+
+  header_t *const block = lists[fl][__builtin_ctz(bits)];
+  assert(block != NULL && block->size >= units);
+  tally(fit_steps, 1);
+  return block;
+}
+
+/*
+ * release_block - frees a block after merging it with its free neighbours in the heap
+ */
+static void release_block(header_t *block) {
+  assert(block->alloc);
+  size_t size = block->size;
+
+  header_t *const right = get_next_in_heap(block);
+  if ((unit_t *)right < next && !right->alloc) {
+    remove_block(right);
+    size += get_total_units(right);
+    tally(coalesces, 1);
+  }
+
+  header_t *const left = get_prev_in_heap(block);
+  if (left != NULL && !left->alloc) {
+    remove_block(left);
+    size += get_total_units(left);
+    block = left;
+    tally(coalesces, 1);
+  }
+
+  block->size = size;
+#ifdef TRIM
+  if (trim_block(block))
+    return;
+#endif
+  insert_block(block);
+}
+
+#ifdef TRIM
+/*
+ * trim_block - gives back a merged block that is about to be freed, if it is at least TRIM_BYTES.
+ *  the heap shrinks if the block ends it, otherwise the pages inside it are released.
+ *  returns whether the heap shrank, in which case the block is gone.
+ */
+static int trim_block(header_t *const block) {
+  assert(block->alloc);
+  const size_t units = MIN_BLOCK_UNITS + block->size;
+  if (units * sizeof(unit_t) < TRIM_BYTES)
+    return 0;
+
+  if ((unit_t *)block + units != next) {
+    // only the header with its links and the footer have to survive
+    mem_release(block + 1, (units - 1) * sizeof(unit_t) - sizeof(header_t));
+    return 0;
+  }
+
+  int64_t bytes;
+  for (bytes = units * (int64_t)sizeof(unit_t); bytes >= INT_MAX; bytes -= INT_MAX)
+    mem_sbrk(-INT_MAX);
+  if (bytes)
+    mem_sbrk(-bytes);
+  next = (unit_t *)block;
+  return 1;
+}
+#endif
+
+/*
+ * split_block - shrinks an allocated block to units of payload - 1, freeing the rest.
+ *  does NOT split if the rest is too small to be a block.
+ */
+static void split_block(header_t *const block, const size_t units) {
+  assert(block->alloc);
+  assert(units <= block->size);
+
+  const size_t remaining = block->size - units;
+  if (remaining < MIN_BLOCK_UNITS)
+    return;
+
+  block->size = units;
+  set_footer(block);
+  tally(splits, 1);
+
+  header_t *const right = get_next_in_heap(block);
+  // -1 for the header, -1 for how units is defined, -1 for the footer
+  right->size = remaining - MIN_BLOCK_UNITS;
+  right->alloc = 1;
+  set_footer(right);
+  release_block(right);
+}
+
+/*
+ * allocate - allocates a block of a payload size in units
+ *  returns the payload or NULL on heap failure.
+ */
+static unit_t *allocate(const size_t units) {
+  header_t *const block = find_block(units);
+  if (block == NULL)
+    return allocate_next(units);
+
+  remove_block(block);
+  split_block(block, units);
+  return get_payload(block);
+}
+
+/*
+ * allocate_aligned - allocates a block of a payload size in units whose payload is
+ *  a multiple of alignment bytes, a power of 2.
+ *  the block found is padded so that an aligned payload at least a block into it fits,
+ *  and the padding before it is freed as a block of its own.
+ *  returns the payload or NULL on heap failure.
+ */
+static unit_t *allocate_aligned(const size_t alignment, const size_t units) {
+  // every payload in the heap is a unit apart from the next
+  if (alignment <= sizeof(unit_t))
+    return allocate(units);
+
+  const size_t pad = MIN_BLOCK_UNITS + alignment / sizeof(unit_t) - 1;
+  if (units + pad >= (size_t)1 << SIZE_BITS)
+    return NULL;
+  unit_t *const payload = allocate(units + pad);
+  if (payload == NULL)
+    return NULL;
+  header_t *block = (header_t *)(payload - 1);
+
+  unit_t *aligned = (unit_t *)(((uintptr_t)payload + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  if (aligned != payload && aligned - payload < MIN_BLOCK_UNITS)
+    aligned += alignment / sizeof(unit_t);
+  if (aligned != payload) {
+    const size_t lead = aligned - payload;
+    header_t *const right = (header_t *)(aligned - 1);
+    right->size = block->size - lead;
+    right->alloc = 1;
+    set_footer(right);
+
+    block->size = lead - MIN_BLOCK_UNITS;
+    set_footer(block);
+    tally(splits, 1);
+    release_block(block);
+    block = right;
+  }
+
+  split_block(block, units);
+  return aligned;
+}
+
+/*
+ * allocate_next - allocates a block at the end of the heap.
+ *  a free block at the end of the heap is extended rather than left behind.
+ *  returns NULL if the heap needs to grow but cannot.
+ */
+static unit_t *allocate_next(const size_t units) {
+  header_t *const last = get_last_in_heap();
+  if (last != NULL && !last->alloc) {
+    if (last->size < units && grow_heap(units - last->size) < 0)
+      return NULL;
+
+    remove_block(last);
+    if (last->size < units) {
+      last->size = units;
+      set_footer(last);
+    }
+    split_block(last, units);
+    return get_payload(last);
+  }
+
+  header_t *const block = (header_t *)next;
+
+  // +1 for header, +1 for first payload unit, +1 for the footer
+  if (grow_heap(MIN_BLOCK_UNITS + units) < 0)
+    return NULL;
+
+  block->size = units;
+  block->alloc = 1;
+  set_footer(block);
+
+  return get_payload(block);
+}
+
+/*
+ * grow_heap - grows the heap in units
+ *  returns 0 on success, -1 on failure
+ */
+static int grow_heap(const size_t units) {
+  assert(units);
+
+  const size_t prev_heapsize = mem_heapsize();
+  int64_t bytes;
+  for (bytes = units * (int64_t)sizeof(unit_t); bytes >= INT_MAX; bytes -= INT_MAX)
+    if (mem_sbrk(INT_MAX) == (void *)-1)
+      goto heapfail;
+  if (bytes && mem_sbrk(bytes) == (void *)-1)
+    goto heapfail;
+
+  next += units;
+  tally(grows, 1);
+  tally(grow_bytes, units * sizeof(unit_t));
+
+  return 0;
+
+ heapfail:
+  mem_reset_brk();
+  mem_sbrk(prev_heapsize);
+  return -1;
+}
+
+/*
+ * mm_init - initialize the malloc package.
+ */
+int mm_init(void) {
+  fl_bitmap = 0;
+  memset(sl_bitmap, 0, sizeof(sl_bitmap));
+  memset(lists, 0, sizeof(lists));
+#ifdef STATS
+  memset(&stats, 0, sizeof(stats));
+#endif
+
+  next = mem_heap_lo();
+
+  return 0;
+}
+
+/*
+ * mm_malloc - Allocate a block.
+ *  If size == 0, returns NULL as a "success."
+ *  If size > 0, returns non-NULL on success, NULL on failure to grow the heap.
+ */
+void *mm_malloc(const size_t size) {
+  if (size == 0)
+    return NULL;
+  return allocate(bytes_to_units(size));
+}
+
+/*
+ * mm_free - Frees a block.
+ *  will abort program if ptr is certainly not an allocated block.
+ */
+void mm_free(void *const ptr) {
+  if (ptr != NULL)
+    release_block(get_header(ptr));
+}
+
+/*
+ * mm_calloc - Allocate a block of nmemb * size bytes that are all zero,
+ *  clearing it only if it was not carved past what the heap ever used.
+ *  If either is 0, returns NULL as a "success."
+ *  Otherwise, returns non-NULL on success, NULL on failure to grow the heap
+ *  or if the product overflows.
+ */
+void *mm_calloc(const size_t nmemb, const size_t size) {
+  if (nmemb == 0 || size == 0 || nmemb > SIZE_MAX / size)
+    return NULL;
+  const size_t bytes = nmemb * size;
+  unit_t *const fresh = mem_arena_fresh(0);
+  unit_t *const payload = mm_malloc(bytes);
+  if (payload != NULL && payload < fresh)
+    memset(payload, 0, bytes);
+  return payload;
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload is a multiple of alignment, a power of 2.
+ *  If size == 0, returns NULL as a "success."
+ *  If size > 0, returns non-NULL on success, NULL on failure to grow the heap
+ *  or if alignment is not a power of 2.
+ */
+void *mm_memalign(const size_t alignment, const size_t size) {
+  if (size == 0 || alignment == 0 || (alignment & (alignment - 1)))
+    return NULL;
+  return allocate_aligned(alignment, bytes_to_units(size));
+}
+
+/*
+ * mm_free_sized - Frees a block of size bytes, as it was allocated or reallocated with,
+ *  or as mm_usable_size gave for it, without looking at its footer.
+ *  will abort program if ptr is certainly not an allocated block of that size.
+ */
+void mm_free_sized(void *const ptr, const size_t size) {
+  if (ptr != NULL)
+    release_block(get_sized_header(ptr, size));
+}
+
+/*
+ * mm_usable_size - Gets how many bytes a block can hold, at least as many as it was
+ *  allocated with, all of which are the caller's to use. Returns 0 for NULL.
+ *  will abort program if ptr is certainly not an allocated block.
+ */
+size_t mm_usable_size(void *const ptr) {
+  if (ptr == NULL)
+    return 0;
+  return (get_header(ptr)->size + 1) * sizeof(unit_t);
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into ptrs, rounding the size once.
+ *  returns how many were allocated, which is n unless the heap failed to grow,
+ *  or none if size == 0.
+ */
+size_t mm_malloc_batch(const size_t size, void **const ptrs, const size_t n) {
+  size_t k = 0;
+  if (size == 0)
+    return 0;
+  const size_t units = bytes_to_units(size);
+  while (k < n && (ptrs[k] = allocate(units)) != NULL)
+    k++;
+  return k;
+}
+
+/*
+ * mm_free_batch - Frees n blocks from ptrs.
+ *  will abort program if any of them is certainly not an allocated block.
+ */
+void mm_free_batch(void **const ptrs, const size_t n) {
+  size_t k;
+  for (k = 0; k < n; k++)
+    if (ptrs[k] != NULL)
+      release_block(get_header(ptrs[k]));
+}
+
+/*
+ * mm_realloc - Resizes a block in place if its right neighbour or the heap allows,
+ *  otherwise moves it.
+ *  A NULL return is a success if bytes == 0, a failure otherwise.
+ *  will abort program if ptr is certainly not an allocated block.
+ */
+void *mm_realloc(void *const ptr, const size_t bytes) {
+  if (ptr == NULL)
+    return mm_malloc(bytes);
+
+  if (bytes == 0) {
+    mm_free(ptr);
+    return NULL;
+  }
+
+  header_t *const block = get_header(ptr);
+  const size_t prev_size = block->size;
+  const size_t size = bytes_to_units(bytes);
+
+  // if smaller size, attempt to split the block
+  if (size <= prev_size) {
+    tally(realloc_shrink, 1);
+    split_block(block, size);
+    return ptr;
+  }
+
+  // absorb a free right neighbour, growing the heap under it if it is the last block
+  header_t *const right = get_next_in_heap(block);
+  if ((unit_t *)right < next && !right->alloc) {
+    const size_t total = prev_size + get_total_units(right);
+    const int is_last = (unit_t *)get_next_in_heap(right) == next;
+    if (total >= size || is_last) {
+      if (total < size && grow_heap(size - total) < 0)
+	return NULL;
+      if (total < size)
+	tally(realloc_grow, 1);
+      else
+	tally(realloc_right, 1);
+
+      remove_block(right);
+      block->size = total < size ? size : total;
+      set_footer(block);
+      split_block(block, size);
+      return ptr;
+    }
+  }
+
+  // grow the heap under the last block
+  if ((unit_t *)right == next) {
+    if (grow_heap(size - prev_size) < 0)
+      return NULL;
+    tally(realloc_grow, 1);
+
+    block->size = size;
+    set_footer(block);
+    return ptr;
+  }
+
+  unit_t *const newPtr = allocate(size);
+  if (newPtr == NULL)
+    return NULL;
+  tally(realloc_move, 1);
+  memcpy(newPtr, ptr, (prev_size + 1) * sizeof(*newPtr));
+  release_block(block);
+
+  return newPtr;
+}
+
+/*
+ * mm_stats - fills in the counters, with a class for each row of lists.
+ *  returns -1 without STATS.
+ */
+int mm_stats(mm_stats_t *const out) {
+#ifdef STATS
+  *out = stats;
+  out->num_classes = FL_COUNT;
+
+  int fl, sl;
+  for (fl = 0; fl < FL_COUNT; fl++)
+    for (sl = 0; sl < SL_COUNT; sl++) {
+      header_t *block;
+      for (block = lists[fl][sl]; block != NULL; block = block->next)
+	out->free_blocks[fl]++;
+    }
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/*
+ * mm_heap_walk - calls walk on every block in the heap, with a class for each row of lists.
+ *  returns the number of classes.
+ */
+int mm_heap_walk(const mm_walk_t walk, void *const arg) {
+  header_t *block;
+  for (block = mem_heap_lo(); (unit_t *)block < next; block = get_next_in_heap(block)) {
+    int fl, sl;
+    get_indices(block->size, &fl, &sl);
+    const mm_block_t b = {get_payload(block), (block->size + 1) * sizeof(unit_t), block->alloc, fl};
+    walk(&b, arg);
+  }
+  return FL_COUNT;
+}
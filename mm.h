@@ -5,6 +5,84 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/*
+ * Batches of blocks of one size, for callers that allocate or free many at once.
+ * mm_malloc_batch puts up to n new blocks of size bytes in ptrs and returns
+ * how many, fewer than n only on failure to grow the heap, and none if size == 0.
+ * mm_free_batch frees n blocks from ptrs, any of which may be NULL.
+ */
+extern size_t mm_malloc_batch(size_t size, void **ptrs, size_t n);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/*
+ * mm_free_sized frees a block the caller knows the size of, which is checked
+ * instead of the block's footer: the size it was last allocated or reallocated
+ * with, or anything up to its mm_usable_size.
+ * mm_usable_size gets how many bytes a block can hold, at least what it was
+ * allocated with, all of which are the caller's to use, or 0 for NULL.
+ */
+extern void mm_free_sized(void *ptr, size_t size);
+extern size_t mm_usable_size(void *ptr);
+
+/*
+ * mm_memalign allocates a block of size bytes whose payload address is a multiple
+ * of alignment, which must be a power of 2. Returns NULL on failure or if it is not,
+ * and as a "success" if size == 0. The block is freed and resized like any other.
+ */
+extern void *mm_memalign(size_t alignment, size_t size);
+
+/*
+ * mm_calloc allocates a block of nmemb * size bytes, all zero, returning NULL
+ * on failure, if the product overflows, and as a "success" if it is 0.
+ * A block carved from memory the heap has never used is not cleared again.
+ */
+extern void *mm_calloc(size_t nmemb, size_t size);
+
+/*
+ * Counters from inside the allocator, for tuning it.
+ * Each variant fills in the counters that apply to it and leaves the rest 0.
+ */
+#define MM_STATS_CLASSES 32
+
+typedef struct {
+    int num_classes;           /* classes filled in below */
+    unsigned long free_blocks[MM_STATS_CLASSES]; /* free list length per class */
+    unsigned long fit_steps;   /* free blocks looked at to find a fit */
+    unsigned long escalations; /* searches that went on to a larger class */
+    unsigned long splits;      /* blocks split to fit a request */
+    unsigned long coalesces;   /* free neighbours merged */
+    unsigned long grows;       /* times the heap grew */
+    unsigned long grow_bytes;  /* bytes the heap grew by */
+    unsigned long realloc_shrink; /* reallocs done in place, shrunk or unchanged */
+    unsigned long realloc_right;  /* ... grown into free blocks to the right */
+    unsigned long realloc_left;   /* ... moved left into free blocks */
+    unsigned long realloc_grow;   /* ... grown at the end of the heap */
+    unsigned long realloc_move;   /* ... moved to a new block */
+} mm_stats_t;
+
+/* Returns 0, or -1 if the allocator was built without counting */
+extern int mm_stats(mm_stats_t *stats);
+
+/*
+ * A block of the heap, as mm_heap_walk finds it.
+ */
+typedef struct {
+    void *payload;      /* start of the payload */
+    size_t bytes;       /* payload bytes the block holds */
+    int alloc;          /* whether the block is allocated */
+    int class_index;    /* its class, as in mm_stats_t, or -1 if it has none */
+} mm_block_t;
+
+typedef void (*mm_walk_t)(const mm_block_t *block, void *arg);
+
+/*
+ * Calls walk(block, arg) on every block of the heap, in address order,
+ * and walk must not call the allocator. Blocks that are mappings of
+ * their own are not in the heap.
+ * Returns the number of classes, or -1 if the heap can't be walked
+ */
+extern int mm_heap_walk(mm_walk_t walk, void *arg);
+
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
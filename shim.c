@@ -0,0 +1,634 @@
+/*
+ * shim.c - Puts mm.c in place of the malloc of libc in a running
+ *     program, preloaded as libmm.so, so that real programs can be
+ *     timed with it against libc, e.g.
+ *
+ *	unix> ./make.sh compact libmm.so
+ *	unix> LD_PRELOAD=./libmm.so ls -lR /usr
+ *
+ * The heap is reserved on the first call, MM_HEAP_MB megabytes of it.
+ * Unless mm.c is built thread-safe, with THREADS or ARENAS, one lock
+ * serializes the calls. mm.c and memlib.c call libc themselves, memlib.c
+ * realloc'ing its table of mappings for one, so a call made from within
+ * the shim is passed on to libc, as is the free or realloc of a block
+ * libc allocated. The payloads of the lab are ALIGNMENT-byte aligned,
+ * but a program assumes twice the size of a pointer, so the shim gets
+ * that from mm_memalign when it is more.
+ *
+ * With MM_TRACE=<file>, the shim also captures every call into <file>,
+ * where %p stands for the pid, for mdriver -f <file> to replay; see
+ * capture.h. A call only reads the clock and fills in a record in a
+ * buffer of its thread. A call that releases a block reads it before
+ * the block can be reused, and one that returns a block after, so that
+ * the records of any two threads sort into an order they can replay
+ * in. A full buffer, or the one of a thread that exits, is written out
+ * by a thread of the shim, and what is left at exit by the last
+ * destructor. A program that ends in _exit or a crash loses that, and
+ * a child it forks isn't captured until it execs.
+ */
+#define _GNU_SOURCE /* for RTLD_NEXT */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "capture.h"
+#include "config.h"
+
+#define HEAP_MB 1024        /* default of MM_HEAP_MB */
+#define BUFFER_RECS 4096    /* records in the buffer of a thread */
+#define SHIM_ALIGNMENT (2 * sizeof(void *))
+
+/* libmm.so exports only what it puts in place of libc */
+#define EXPORT __attribute__((visibility("default")))
+
+/* the model a shared library uses by default may allocate on first use */
+#define THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+
+/* the malloc of libc, for the blocks that aren't ours */
+extern void *__libc_malloc(size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+static size_t (*libc_usable_size)(void *ptr);
+
+/* A buffer of records, of a thread or queued to be written */
+typedef struct buffer {
+    struct buffer *next;
+    struct buffer *prev;    /* only while a thread fills it */
+    int count;              /* records filled in */
+    caprec_t recs[BUFFER_RECS];
+} buffer_t;
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static int ready;           /* mm_init succeeded */
+#if !defined(THREADS) && !defined(ARENAS)
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static THREAD_LOCAL int in_shim;       /* in a call of the shim already */
+static THREAD_LOCAL buffer_t *buffer;  /* being filled by this thread */
+static THREAD_LOCAL uint32_t tid;
+
+/* The capture, all under cap_lock but what a thread fills in */
+static int cap_fd = -1;     /* -1 if not capturing */
+static pthread_mutex_t cap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cap_queued = PTHREAD_COND_INITIALIZER; /* to the writer */
+static pthread_cond_t cap_written = PTHREAD_COND_INITIALIZER; /* from the writer */
+static buffer_t *filling;   /* buffers of the threads */
+static buffer_t *queue;     /* buffers to write, in any order */
+static buffer_t *spare;     /* buffers written out */
+static int writing;         /* the writer has a buffer off the queue */
+static int writer_started;
+static pthread_key_t buffer_key; /* queues a buffer as its thread exits */
+
+static void init(void);
+static void open_capture(const char *path);
+static uint64_t clock_now(void);
+static void record(uint32_t type, uint64_t nsecs, void *ptr, void *result, size_t size);
+static buffer_t *next_buffer(buffer_t *full);
+static void unfill(buffer_t *b);
+static void start_writer(void);
+static void *writer(void *arg);
+static void write_buffer(buffer_t *b);
+static void thread_exit(void *b);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+
+/*
+ * enter - start a call, returning 0 if libc has to take it instead
+ */
+static int enter(void)
+{
+    if (in_shim)
+	return 0;
+    in_shim = 1;
+    pthread_once(&init_once, init);
+    if (!ready) {
+	in_shim = 0;
+	return 0;
+    }
+#if !defined(THREADS) && !defined(ARENAS)
+    pthread_mutex_lock(&mm_lock);
+#endif
+    return 1;
+}
+
+/*
+ * leave - end a call that enter started
+ */
+static void leave(void)
+{
+#if !defined(THREADS) && !defined(ARENAS)
+    pthread_mutex_unlock(&mm_lock);
+#endif
+    in_shim = 0;
+}
+
+/*
+ * ours - return whether a block is mm.c's rather than libc's
+ */
+static int ours(void *ptr)
+{
+    return mem_in_heap(ptr) || mem_is_mapped(ptr, ptr);
+}
+
+/*
+ * allocate - allocate a block aligned to at least SHIM_ALIGNMENT,
+ *     setting errno on failure like libc
+ */
+static void *allocate(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment < SHIM_ALIGNMENT)
+	alignment = SHIM_ALIGNMENT;
+    if (size == 0)
+	size = 1; /* a block of its own, like libc */
+    p = (alignment > ALIGNMENT) ? mm_memalign(alignment, size) : mm_malloc(size);
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+/*
+ * aligned - allocate a block for memalign and its kin, taking any
+ *     alignment that is a power of 2
+ */
+static void *aligned(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment == 0 || (alignment & (alignment - 1))) {
+	errno = EINVAL;
+	return NULL;
+    }
+    if (!enter())
+	return __libc_memalign(alignment, size);
+    p = allocate(alignment, size);
+    record(CAPTURE_MEMALIGN, clock_now(), NULL, p, size);
+    leave();
+    return p;
+}
+
+EXPORT void *malloc(size_t size)
+{
+    void *p;
+
+    if (!enter())
+	return __libc_malloc(size);
+    p = allocate(0, size);
+    record(CAPTURE_MALLOC, clock_now(), NULL, p, size);
+    leave();
+    return p;
+}
+
+EXPORT void free(void *ptr)
+{
+    uint64_t nsecs;
+
+    if (ptr == NULL)
+	return;
+    if (!enter()) {
+	__libc_free(ptr);
+	return;
+    }
+    if (!ours(ptr)) {
+	leave();
+	__libc_free(ptr);
+	return;
+    }
+    nsecs = clock_now();
+    mm_free(ptr);
+    record(CAPTURE_FREE, nsecs, ptr, NULL, 0);
+    leave();
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    uint64_t nsecs;
+    void *p, *q;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    if (!enter())
+	return __libc_realloc(ptr, size);
+    if (!ours(ptr)) {
+	leave();
+	return __libc_realloc(ptr, size);
+    }
+    nsecs = clock_now(); /* as ptr may be reused once it is moved */
+    p = mm_realloc(ptr, size);
+    /* mm_realloc aligns the block it moves to like mm_malloc does */
+    if (p != NULL && (uintptr_t)p % SHIM_ALIGNMENT != 0 &&
+	(q = mm_memalign(SHIM_ALIGNMENT, size)) != NULL) {
+	memcpy(q, p, size);
+	mm_free(p);
+	p = q;
+    }
+    if (p == NULL)
+	errno = ENOMEM;
+    record(CAPTURE_REALLOC, nsecs, ptr, p, size);
+    leave();
+    return p;
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    size_t bytes;
+    void *p;
+#if !defined(THREADS) && !defined(ARENAS)
+    void *fresh;
+#endif
+
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (!enter())
+	return __libc_calloc(nmemb, size);
+    if (SHIM_ALIGNMENT > ALIGNMENT) {
+	/* mm_calloc has no alignment to ask for, so clear the block
+	   unless it is past what the heap had ever used, as mm_calloc does */
+#if !defined(THREADS) && !defined(ARENAS)
+	fresh = mem_arena_fresh(0);
+	if ((p = allocate(0, bytes)) != NULL && (char *)p < (char *)fresh)
+	    memset(p, 0, bytes);
+#else
+	/* which another thread may have used and freed meanwhile */
+	if ((p = allocate(0, bytes)) != NULL)
+	    memset(p, 0, bytes);
+#endif
+    } else if ((p = mm_calloc(1, bytes ? bytes : 1)) == NULL)
+	errno = ENOMEM;
+    record(CAPTURE_CALLOC, clock_now(), NULL, p, bytes);
+    leave();
+    return p;
+}
+
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+    return aligned(alignment, size);
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+    return aligned(alignment, size);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)))
+	return EINVAL;
+    if ((p = aligned(alignment, size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return aligned(sysconf(_SC_PAGESIZE), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    return aligned(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+    size_t bytes;
+
+    if (ptr == NULL)
+	return 0;
+    if (!enter())
+	return libc_usable_size ? libc_usable_size(ptr) : 0;
+    if (!ours(ptr)) {
+	leave();
+	return libc_usable_size(ptr);
+    }
+    bytes = mm_usable_size(ptr);
+    leave();
+    return bytes;
+}
+
+/*
+ * init - reserve the heap and start capturing, on the first call
+ */
+static void init(void)
+{
+    char *mb = getenv("MM_HEAP_MB");
+    char *path = getenv("MM_TRACE");
+
+    libc_usable_size = (size_t (*)(void *))dlsym(RTLD_NEXT, "malloc_usable_size");
+    mem_configure((size_t)(mb ? atol(mb) : HEAP_MB) << 20, 0);
+    mem_init();
+    if (mm_init() < 0) {
+	fprintf(stderr, "libmm.so: mm_init failed, so libc allocates instead\n");
+	return;
+    }
+    if (path != NULL && *path != '\0')
+	open_capture(path);
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+    ready = 1;
+}
+
+/*
+ * open_capture - create the capture file, putting the pid in for %p
+ */
+static void open_capture(const char *path)
+{
+    char name[4096];
+    capthdr_t hdr;
+    size_t i, j;
+    int fd;
+
+    for (i = j = 0; path[i] != '\0' && j < sizeof(name) - 16; i++) {
+	if (path[i] == '%' && path[i + 1] == 'p')
+	    j += sprintf(name + j, "%d", (int)getpid()), i++;
+	else
+	    name[j++] = path[i];
+    }
+    name[j] = '\0';
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+    hdr.rec_bytes = sizeof(caprec_t);
+    hdr.pid = getpid();
+    if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0 ||
+	write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+	fprintf(stderr, "libmm.so: Could not create %s for MM_TRACE\n", name);
+	if (fd >= 0)
+	    close(fd);
+	return;
+    }
+    pthread_key_create(&buffer_key, thread_exit);
+    cap_fd = fd;
+}
+
+/*
+ * clock_now - read the clock for the record of a call, if capturing
+ */
+static uint64_t clock_now(void)
+{
+    struct timespec now;
+
+    if (__atomic_load_n(&cap_fd, __ATOMIC_RELAXED) < 0)
+	return 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * record - capture a call in the buffer of the thread, at the time
+ *     clock_now read for it
+ */
+static void record(uint32_t type, uint64_t nsecs, void *ptr, void *result, size_t size)
+{
+    caprec_t *rec;
+
+    if (__atomic_load_n(&cap_fd, __ATOMIC_RELAXED) < 0)
+	return;
+    if ((buffer == NULL || buffer->count == BUFFER_RECS) &&
+	(buffer = next_buffer(buffer)) == NULL)
+	return;
+    if (tid == 0)
+	tid = syscall(SYS_gettid);
+
+    rec = &buffer->recs[buffer->count];
+    rec->nsecs = nsecs;
+    rec->ptr = (uintptr_t)ptr;
+    rec->result = (uintptr_t)result;
+    rec->size = size;
+    rec->tid = tid;
+    rec->type = type;
+    /* what the last destructor writes out is only ever whole records */
+    __atomic_store_n(&buffer->count, buffer->count + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * next_buffer - queue the full buffer of the thread, if any, and get it
+ *     an empty one, or NULL if there is none or the capture is over
+ */
+static buffer_t *next_buffer(buffer_t *full)
+{
+    buffer_t *b = NULL;
+
+    pthread_mutex_lock(&cap_lock);
+    if (cap_fd < 0)
+	goto out;
+    if (full != NULL) {
+	unfill(full);
+	full->next = queue;
+	queue = full;
+	if (!writer_started)
+	    start_writer();
+	pthread_cond_signal(&cap_queued);
+    }
+    if (spare != NULL) {
+	b = spare;
+	spare = b->next;
+    } else {
+	b = mmap(NULL, sizeof(buffer_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b == MAP_FAILED) {
+	    b = NULL;
+	    goto out;
+	}
+    }
+    b->count = 0;
+    b->prev = NULL;
+    b->next = filling;
+    if (filling != NULL)
+	filling->prev = b;
+    filling = b;
+ out:
+    pthread_setspecific(buffer_key, b);
+    pthread_mutex_unlock(&cap_lock);
+    return b;
+}
+
+/*
+ * unfill - take a buffer off the list of those the threads fill
+ */
+static void unfill(buffer_t *b)
+{
+    if (b->prev != NULL)
+	b->prev->next = b->next;
+    else
+	filling = b->next;
+    if (b->next != NULL)
+	b->next->prev = b->prev;
+}
+
+/*
+ * start_writer - start the thread that writes out the queue, with
+ *     every signal blocked so that they are left to the program
+ */
+static void start_writer(void)
+{
+    pthread_t thread;
+    sigset_t all, old;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&thread, NULL, writer, NULL) == 0) {
+	pthread_detach(thread);
+	writer_started = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/*
+ * writer - write out the buffers as they are queued
+ */
+static void *writer(void *arg)
+{
+    buffer_t *b;
+
+    (void)arg;
+    in_shim = 1; /* for anything libc does on this thread */
+    pthread_mutex_lock(&cap_lock);
+    for (;;) {
+	while (queue == NULL)
+	    pthread_cond_wait(&cap_queued, &cap_lock);
+	b = queue;
+	queue = b->next;
+	writing = 1;
+	pthread_mutex_unlock(&cap_lock);
+	write_buffer(b);
+	pthread_mutex_lock(&cap_lock);
+	writing = 0;
+	b->next = spare;
+	spare = b;
+	pthread_cond_broadcast(&cap_written);
+    }
+    return NULL;
+}
+
+/*
+ * write_buffer - write the records of a buffer to the capture file
+ */
+static void write_buffer(buffer_t *b)
+{
+    const char *p = (const char *)b->recs;
+    size_t left = __atomic_load_n(&b->count, __ATOMIC_ACQUIRE) * sizeof(caprec_t);
+    ssize_t n;
+
+    while (left > 0) {
+	if ((n = write(cap_fd, p, left)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fprintf(stderr, "libmm.so: Could not write the capture of MM_TRACE\n");
+	    return;
+	}
+	p += n;
+	left -= n;
+    }
+}
+
+/*
+ * thread_exit - queue the buffer of a thread that exits
+ */
+static void thread_exit(void *b)
+{
+    pthread_mutex_lock(&cap_lock);
+    if (cap_fd >= 0 && b == buffer) {
+	unfill(b);
+	buffer->next = queue;
+	queue = b;
+	if (!writer_started)
+	    start_writer();
+	pthread_cond_signal(&cap_queued);
+    }
+    buffer = NULL;
+    pthread_mutex_unlock(&cap_lock);
+}
+
+/*
+ * finish_capture - write out every buffer left once the program exits,
+ *     leaving the calls of the destructors after this one uncaptured
+ */
+__attribute__((destructor))
+static void finish_capture(void)
+{
+    buffer_t *b;
+
+    if (cap_fd < 0)
+	return;
+    in_shim = 1;
+#if !defined(THREADS) && !defined(ARENAS)
+    pthread_mutex_lock(&mm_lock); /* not to write a buffer as it is filled */
+#endif
+    pthread_mutex_lock(&cap_lock);
+    while (writing)
+	pthread_cond_wait(&cap_written, &cap_lock);
+    for (b = queue; b != NULL; b = b->next)
+	write_buffer(b);
+    for (b = filling; b != NULL; b = b->next)
+	write_buffer(b);
+    close(cap_fd);
+    __atomic_store_n(&cap_fd, -1, __ATOMIC_RELAXED);
+    queue = filling = NULL;
+    buffer = NULL;
+    pthread_mutex_unlock(&cap_lock);
+#if !defined(THREADS) && !defined(ARENAS)
+    pthread_mutex_unlock(&mm_lock);
+#endif
+    in_shim = 0;
+}
+
+/*
+ * fork_prepare, fork_parent, fork_child - keep the locks across a fork,
+ *     and stop capturing in the child, whose records would be mixed up
+ *     with the parent's, and which has no writer
+ */
+static void fork_prepare(void)
+{
+#if !defined(THREADS) && !defined(ARENAS)
+    pthread_mutex_lock(&mm_lock);
+#endif
+    pthread_mutex_lock(&cap_lock);
+}
+
+static void fork_parent(void)
+{
+    pthread_mutex_unlock(&cap_lock);
+#if !defined(THREADS) && !defined(ARENAS)
+    pthread_mutex_unlock(&mm_lock);
+#endif
+}
+
+static void fork_child(void)
+{
+    if (cap_fd >= 0)
+	close(cap_fd);
+    cap_fd = -1;
+    filling = queue = NULL;
+    writing = writer_started = 0;
+    buffer = NULL;
+    tid = 0;
+    fork_parent();
+}
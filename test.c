@@ -18,6 +18,7 @@ array test_malloc(const size_t s) {
   printf("mm_malloc(%u)\n", s);
   const array a = {mm_malloc(s), s};
   assert(a.p != NULL);
+  assert(mm_usable_size(a.p) >= s);
 
   size_t i;
   for (i = 0; i < a.s; i++)
@@ -26,6 +27,35 @@ array test_malloc(const size_t s) {
   return a;
 }
 
+array test_memalign(const size_t alignment, const size_t s) {
+  printf("mm_memalign(%u, %u)\n", alignment, s);
+  const array a = {mm_memalign(alignment, s), s};
+  assert(a.p != NULL);
+  assert((size_t)a.p % alignment == 0);
+  assert(mm_usable_size(a.p) >= s);
+
+  size_t i;
+  for (i = 0; i < a.s; i++)
+    ((char *)a.p)[i] = rand();
+
+  return a;
+}
+
+array test_calloc(const size_t n, const size_t s) {
+  printf("mm_calloc(%u, %u)\n", n, s);
+  const array a = {mm_calloc(n, s), n * s};
+  assert(a.p != NULL);
+  assert(mm_usable_size(a.p) >= a.s);
+
+  size_t i;
+  for (i = 0; i < a.s; i++) {
+    assert(((char *)a.p)[i] == 0);
+    ((char *)a.p)[i] = rand();
+  }
+
+  return a;
+}
+
 array test_realloc(const array a, const size_t s) {
   char tmp[a.s];
   memcpy(tmp, a.p, a.s);
@@ -33,6 +63,7 @@ array test_realloc(const array a, const size_t s) {
   printf("mm_realloc(%p, %u)\n", a.p, s);
   const array b = {mm_realloc(a.p, s), s};
   assert(b.p != NULL);
+  assert(mm_usable_size(b.p) >= s);
   assert(!memcmp(b.p, tmp, min(a.s, b.s)));
 
   if (b.s > a.s) {
@@ -50,6 +81,11 @@ void test_free(const array a) {
   mm_free(a.p);
 }
 
+void test_free_sized(const array a) {
+  printf("mm_free_sized(%p, %u)\n", a.p, a.s);
+  mm_free_sized(a.p, a.s);
+}
+
 int main() {
   mem_init();
   mm_init();
@@ -63,7 +99,18 @@ int main() {
   b = test_realloc(b, 512);
   b = test_realloc(b, 640);
   b = test_realloc(b, 4096);
-  test_free(b);
+  test_free_sized(b);
+  array c = test_memalign(64, 200);
+  c = test_realloc(c, 1000);
+  array d = test_memalign(4096, 100);
+  test_free(c);
+  test_free(d);
+  array e = test_calloc(16, 100);
+  array f = test_calloc(1, 8192);
+  test_free(e);
+  test_free(f);
+  e = test_calloc(1, 8192);
+  test_free(e);
   mem_deinit();
   return 0;
 }
@@ -0,0 +1,54 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+# batch.rep allocates the nodes of every request in one batch, beside a
+# buffer of its own, and frees them all once the next request is done.
+# batch-single.rep makes the same requests one at a time.
+$num_iters = 400;
+$num_nodes = 32;
+$node_size = 48;
+$max_buf_size = 1024;
+srand(1);
+
+$num_blocks = $num_iters * ($num_nodes + 1);
+$num_ops = 2 * $num_blocks;
+$suggested_heap_size = 2 * ($num_nodes * $node_size + $max_buf_size) + 100;
+
+for ($i = 0;  $i < $num_iters; $i += 1) {
+    $seq = $i * ($num_nodes + 1);
+    $buf_size = 1 + int(rand $max_buf_size);
+    push @trace, ["A", $seq, $num_nodes, $node_size];
+    push @trace, ["a", $seq + $num_nodes, $buf_size];
+    if ($i > 0) {
+	$fseq = $seq - $num_nodes - 1;
+	push @trace, ["F", $fseq, $num_nodes];
+	push @trace, ["f", $fseq + $num_nodes];
+    }
+}
+$fseq = ($num_iters - 1) * ($num_nodes + 1);
+push @trace, ["F", $fseq, $num_nodes];
+push @trace, ["f", $fseq + $num_nodes];
+
+foreach $out_filename ("batch.rep", "batch-single.rep") {
+    open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+    print OUTFILE "$suggested_heap_size\n";
+    print OUTFILE "$num_blocks\n";
+    print OUTFILE "$num_ops\n";
+    print OUTFILE "1\n";
+    foreach $op (@trace) {
+	($cmd, $seq, $n, $size) = @$op;
+	if ($cmd eq "a") {
+	    print OUTFILE "a $seq $n\n";
+	} elsif ($cmd eq "f") {
+	    print OUTFILE "f $seq\n";
+	} elsif ($out_filename eq "batch.rep") {
+	    print OUTFILE $cmd eq "A" ? "A $seq $n $size\n" : "F $seq $n\n";
+	} else {
+	    for ($k = 0; $k < $n; $k += 1) {
+		print OUTFILE $cmd eq "A" ? "a " . ($seq + $k) . " $size\n"
+		    : "f " . ($seq + $k) . "\n";
+	    }
+	}
+    }
+    close OUTFILE;
+}
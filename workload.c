@@ -0,0 +1,415 @@
+/****************************************
+ * Synthetic workloads
+ ****************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "workload.h"
+
+/* The distributions of sizes and lifetimes */
+typedef enum {DIST_UNIFORM, DIST_LOGNORMAL, DIST_POWER, DIST_BIMODAL,
+	      DIST_EXP} distkind_t;
+
+typedef struct {
+    distkind_t kind;
+    double a, b, c;  /* the parameters, in the order of the spec */
+} dist_t;
+
+/* A live block and when it is to be freed */
+typedef struct {
+    double death;
+    int id;
+} wlblock_t;
+
+struct workload {
+    /* the spec */
+    int num_ops;
+    int live;
+    dist_t size;
+    int max_size;
+    dist_t life;
+    double realloc_p, realloc_f;
+    unsigned long long rng;
+
+    /* the state */
+    int op;              /* number of requests made so far */
+    double mean_life;    /* in requests */
+    wlblock_t *heap;     /* the live blocks, a min-heap on death */
+    int num_live;
+    int *sizes;          /* size of each id */
+    int *free_ids;       /* a stack of the ids of freed blocks */
+    int num_free_ids;
+    int num_ids;         /* ids ever handed out */
+    int max_ids;         /* capacity of the arrays */
+    int youngest;        /* id of the last block allocated, or -1 if freed */
+    long bytes, peak_bytes;
+};
+
+/*
+ * rand_unit - a pseudorandom number in (0, 1], from xorshift64*
+ */
+static double rand_unit(workload_t *wl)
+{
+    wl->rng ^= wl->rng >> 12;
+    wl->rng ^= wl->rng << 25;
+    wl->rng ^= wl->rng >> 27;
+    return (double)(((wl->rng * 2685821657736338717ULL) >> 11) + 1)
+	/ 9007199254740992.0;
+}
+
+/*
+ * rand_normal - a standard normal deviate, by Box-Muller
+ */
+static double rand_normal(workload_t *wl)
+{
+    double r = sqrt(-2 * log(rand_unit(wl)));
+
+    return r * cos(2 * M_PI * rand_unit(wl));
+}
+
+/*
+ * draw_size - a payload size from the size distribution
+ */
+static int draw_size(workload_t *wl)
+{
+    dist_t *d = &wl->size;
+    double s;
+
+    switch (d->kind) {
+    case DIST_UNIFORM:
+	s = d->a + floor((1 - rand_unit(wl)) * (d->b - d->a + 1));
+	break;
+    case DIST_LOGNORMAL:
+	s = d->a * exp(d->b * rand_normal(wl));
+	break;
+    case DIST_POWER:
+	s = d->a * pow(rand_unit(wl), -1 / d->b);
+	break;
+    default: /* DIST_BIMODAL */
+	s = (rand_unit(wl) <= d->c) ? d->a : d->b;
+	break;
+    }
+    if (s < 1)
+	return 1;
+    if (s > wl->max_size)
+	return wl->max_size;
+    return (int)s;
+}
+
+/*
+ * draw_life - a block lifetime in requests, whose mean is wl->mean_life
+ */
+static double draw_life(workload_t *wl)
+{
+    dist_t *d = &wl->life;
+    double m = wl->mean_life;
+
+    switch (d->kind) {
+    case DIST_UNIFORM:
+	return 2 * m * rand_unit(wl);
+    case DIST_LOGNORMAL:
+	return m * exp(d->a * rand_normal(wl) - d->a * d->a / 2);
+    case DIST_POWER:
+	return m * (d->a - 1) / d->a * pow(rand_unit(wl), -1 / d->a);
+    default: /* DIST_EXP */
+	return -m * log(rand_unit(wl));
+    }
+}
+
+/*
+ * heap_push, heap_pop - add a live block, and take out the one to die first
+ */
+static void heap_push(workload_t *wl, double death, int id)
+{
+    int i = wl->num_live++;
+
+    while (i > 0 && wl->heap[(i - 1) / 2].death > death) {
+	wl->heap[i] = wl->heap[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    wl->heap[i].death = death;
+    wl->heap[i].id = id;
+}
+
+static int heap_pop(workload_t *wl)
+{
+    int id = wl->heap[0].id;
+    wlblock_t last = wl->heap[--wl->num_live];
+    int i = 0, child;
+
+    while ((child = 2 * i + 1) < wl->num_live) {
+	if (child + 1 < wl->num_live &&
+	    wl->heap[child + 1].death < wl->heap[child].death)
+	    child++;
+	if (wl->heap[child].death >= last.death)
+	    break;
+	wl->heap[i] = wl->heap[child];
+	i = child;
+    }
+    wl->heap[i] = last;
+    return id;
+}
+
+/*
+ * new_id - an id for a new block, reusing that of a freed block if any
+ */
+static int new_id(workload_t *wl)
+{
+    if (wl->num_free_ids > 0)
+	return wl->free_ids[--wl->num_free_ids];
+    if (wl->num_ids == wl->max_ids) {
+	wl->max_ids = wl->max_ids ? 2 * wl->max_ids : 1024;
+	if ((wl->heap = realloc(wl->heap, wl->max_ids * sizeof(wlblock_t))) == NULL ||
+	    (wl->sizes = realloc(wl->sizes, wl->max_ids * sizeof(int))) == NULL ||
+	    (wl->free_ids = realloc(wl->free_ids, wl->max_ids * sizeof(int))) == NULL) {
+	    fprintf(stderr, "ERROR: realloc failed in new_id\n");
+	    exit(1);
+	}
+    }
+    return wl->num_ids++;
+}
+
+/*
+ * parse_count - parse a count with an optional k or m suffix
+ */
+static int parse_count(const char *s, double *x)
+{
+    char *end;
+
+    *x = strtod(s, &end);
+    if (end == s)
+	return 0;
+    if (*end == 'k' || *end == 'K') {
+	*x *= 1e3;
+	end++;
+    }
+    else if (*end == 'm' || *end == 'M') {
+	*x *= 1e6;
+	end++;
+    }
+    return *end == '\0';
+}
+
+/*
+ * parse_dist - parse name:a:b:c into a distribution, checking that
+ *     it has as many parameters as its kind needs
+ */
+static int parse_dist(char *s, dist_t *d, int life)
+{
+    char *save;
+    char *name = strtok_r(s, ":", &save);
+    char *arg;
+    double p[3];
+    int n = 0, want;
+
+    while (n < 3 && (arg = strtok_r(NULL, ":", &save)) != NULL)
+	if (!parse_count(arg, &p[n++]))
+	    return 0;
+    if (strtok_r(NULL, ":", &save) != NULL || name == NULL)
+	return 0;
+    if (!strcmp(name, "uniform")) {
+	d->kind = DIST_UNIFORM;
+	want = life ? 0 : 2;
+    }
+    else if (!strcmp(name, "lognormal")) {
+	d->kind = DIST_LOGNORMAL;
+	want = life ? 1 : 2;
+    }
+    else if (!strcmp(name, "power")) {
+	d->kind = DIST_POWER;
+	want = life ? 1 : 2;
+    }
+    else if (!strcmp(name, "bimodal") && !life) {
+	d->kind = DIST_BIMODAL;
+	want = 3;
+    }
+    else if (!strcmp(name, "exp") && life) {
+	d->kind = DIST_EXP;
+	want = 0;
+    }
+    else
+	return 0;
+    if (n != want)
+	return 0;
+    d->a = p[0];
+    d->b = p[1];
+    d->c = p[2];
+    if (life)
+	return (d->kind != DIST_LOGNORMAL || d->a >= 0) &&
+	    (d->kind != DIST_POWER || d->a > 1);
+    switch (d->kind) {
+    case DIST_UNIFORM:
+	return d->a >= 1 && d->b >= d->a;
+    case DIST_LOGNORMAL:
+	return d->a >= 1 && d->b >= 0;
+    case DIST_POWER:
+	return d->a >= 1 && d->b > 0;
+    default:
+	return d->a >= 1 && d->b >= 1 && d->c >= 0 && d->c <= 1;
+    }
+}
+
+/*
+ * wl_create - Make the workload of a spec. On a bad spec, return NULL
+ *     with a message in err, which holds errlen bytes.
+ */
+workload_t *wl_create(const char *spec, char *err, size_t errlen)
+{
+    workload_t *wl;
+    char *buf, *pair, *save, *key = NULL, *value, *f;
+    double x, y = 0;
+    int ok = 1;
+
+    if ((wl = calloc(1, sizeof(workload_t))) == NULL ||
+	(buf = strdup(spec)) == NULL) {
+	fprintf(stderr, "ERROR: malloc failed in wl_create\n");
+	exit(1);
+    }
+    wl->num_ops = 1000000;
+    wl->live = 1000;
+    wl->size.kind = DIST_LOGNORMAL;
+    wl->size.a = 64;
+    wl->size.b = 1;
+    wl->max_size = 1 << 20;
+    wl->life.kind = DIST_EXP;
+    wl->realloc_f = 2;
+    wl->rng = 1;
+
+    for (pair = strtok_r(buf, ",", &save); ok && pair != NULL;
+	 pair = strtok_r(NULL, ",", &save)) {
+	key = pair;
+	if ((value = strchr(pair, '=')) == NULL) {
+	    ok = 0;
+	    break;
+	}
+	*value++ = '\0';
+	if (!strcmp(key, "size"))
+	    ok = parse_dist(value, &wl->size, 0);
+	else if (!strcmp(key, "life"))
+	    ok = parse_dist(value, &wl->life, 1);
+	else if (!strcmp(key, "realloc")) {
+	    if ((f = strchr(value, ':')) != NULL)
+		*f++ = '\0';
+	    ok = parse_count(value, &x) && x >= 0 && x < 1 &&
+		(f == NULL || (parse_count(f, &y) && y > 0));
+	    wl->realloc_p = x;
+	    if (f != NULL)
+		wl->realloc_f = y;
+	}
+	else if ((ok = parse_count(value, &x))) {
+	    if (!strcmp(key, "ops") && x >= 1 && x <= (1 << 30))
+		wl->num_ops = (int)x;
+	    else if (!strcmp(key, "live") && x >= 1 && x < (1 << 30))
+		wl->live = (int)x;
+	    else if (!strcmp(key, "max") && x >= 1 && x <= 0x7fffffff)
+		wl->max_size = (int)x;
+	    else if (!strcmp(key, "seed") && x >= 0)
+		wl->rng = (unsigned long long)x + 1;
+	    else
+		ok = 0;
+	}
+    }
+    if (!ok) {
+	snprintf(err, errlen, "bad workload spec %s at %s", spec, key);
+	free(buf);
+	free(wl);
+	return NULL;
+    }
+    free(buf);
+
+    /*
+     * By Little's law, blocks are live for live / (allocation rate)
+     * requests. Every allocation is freed once, and a realloc takes
+     * the place of a fraction realloc_p of them, so a fraction
+     * (1 - p) / (2 - p) of the requests are allocations.
+     */
+    wl->mean_life = wl->live * (2 - wl->realloc_p) / (1 - wl->realloc_p);
+    wl->youngest = -1;
+    return wl;
+}
+
+/*
+ * wl_next - Make the next request of the workload in op, returning 0
+ *     once all of them have been made. Blocks are freed when their
+ *     lifetimes run out, and all that are left once there are no more
+ *     requests to spare.
+ */
+int wl_next(workload_t *wl, wlop_t *op)
+{
+    int left = wl->num_ops - wl->op;
+    int id;
+    double f;
+
+    if (left == 0)
+	return 0;
+    if (wl->num_live > 0 &&
+	(left <= wl->num_live + 1 || wl->heap[0].death <= wl->op)) {
+	id = heap_pop(wl);
+	op->type = WL_FREE;
+	op->index = id;
+	op->size = 0;
+	wl->bytes -= wl->sizes[id];
+	wl->free_ids[wl->num_free_ids++] = id;
+	if (wl->youngest == id)
+	    wl->youngest = -1;
+    }
+    else if (wl->youngest >= 0 && rand_unit(wl) <= wl->realloc_p) {
+	id = wl->youngest;
+	f = wl->sizes[id] * wl->realloc_f + 0.5;
+	op->type = WL_REALLOC;
+	op->index = id;
+	op->size = (f < 1) ? 1 : (f > wl->max_size) ? wl->max_size : (int)f;
+	wl->bytes += op->size - wl->sizes[id];
+	wl->sizes[id] = op->size;
+    }
+    else {
+	id = new_id(wl);
+	op->type = WL_ALLOC;
+	op->index = id;
+	op->size = draw_size(wl);
+	wl->sizes[id] = op->size;
+	wl->bytes += op->size;
+	wl->youngest = id;
+	heap_push(wl, wl->op + draw_life(wl), id);
+    }
+    if (wl->bytes > wl->peak_bytes)
+	wl->peak_bytes = wl->bytes;
+    wl->op++;
+    return 1;
+}
+
+/*
+ * wl_num_ops - the number of requests of the workload
+ */
+int wl_num_ops(const workload_t *wl)
+{
+    return wl->num_ops;
+}
+
+/*
+ * wl_num_ids - the number of block ids the requests made so far used
+ */
+int wl_num_ids(const workload_t *wl)
+{
+    return wl->num_ids;
+}
+
+/*
+ * wl_peak_bytes - the most payload bytes live at once so far
+ */
+long wl_peak_bytes(const workload_t *wl)
+{
+    return wl->peak_bytes;
+}
+
+/*
+ * wl_free - free a workload
+ */
+void wl_free(workload_t *wl)
+{
+    free(wl->heap);
+    free(wl->sizes);
+    free(wl->free_ids);
+    free(wl);
+}
@@ -0,0 +1,40 @@
+/*
+ * workload.h - Synthetic workloads, generated one request at a time
+ *
+ * A workload is described by a spec of comma-separated key=value
+ * pairs, e.g. "ops=10m,live=100k,size=lognormal:48:1.2,realloc=0.05:2".
+ * See WL_USAGE for the keys.
+ */
+
+/* The types of request, in the order of the trace requests of mdriver */
+enum {WL_ALLOC, WL_FREE, WL_REALLOC};
+
+typedef struct {
+    int type;   /* WL_ALLOC, WL_FREE or WL_REALLOC */
+    int index;  /* id of the block, reused once the block is freed */
+    int size;   /* byte size of an alloc or realloc */
+} wlop_t;
+
+typedef struct workload workload_t;
+
+#define WL_USAGE \
+    "\t  ops=<n>        number of requests (default 1m)\n" \
+    "\t  live=<n>       blocks live at once in the steady state (default 1k)\n" \
+    "\t  size=<dist>    payload sizes in bytes (default lognormal:64:1), one of\n" \
+    "\t                 uniform:<lo>:<hi>, lognormal:<median>:<sigma>,\n" \
+    "\t                 power:<min>:<alpha>, bimodal:<a>:<b>:<p of a>\n" \
+    "\t  max=<bytes>    largest payload, also after a realloc (default 1m)\n" \
+    "\t  life=<dist>    shape of the block lifetimes, whose mean live sets\n" \
+    "\t                 (default exp), one of exp, uniform,\n" \
+    "\t                 lognormal:<sigma>, power:<alpha above 1>\n" \
+    "\t  realloc=<p>:<f> make a fraction p of the allocations realloc the\n" \
+    "\t                 youngest block to f times its size (default 0:2)\n" \
+    "\t  seed=<n>       seed of the random numbers (default 1)\n" \
+    "\t  Numbers take a k or m suffix for thousands or millions.\n"
+
+workload_t *wl_create(const char *spec, char *err, size_t errlen);
+int wl_next(workload_t *wl, wlop_t *op);
+int wl_num_ops(const workload_t *wl);
+int wl_num_ids(const workload_t *wl);
+long wl_peak_bytes(const workload_t *wl);
+void wl_free(workload_t *wl);